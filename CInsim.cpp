@@ -33,10 +33,14 @@
  */
 
 #include <CInsim.h>
+#include <CInsimShm.h>
+#include <CInsimRegistry.h>
+#include <CInsimCars.h>
+#include <CInsimFrames.h>
 
-#ifdef CIS_LINUX
-#define INVALID_SOCKET -1
-#endif
+#include <utility>
+#include <chrono>
+#include <thread>
 
 #define IS_BTN_HDRSIZE 12
 #define IS_BTN_MAXTLEN 239
@@ -70,6 +74,8 @@ CInsim::removeInstance()
 {
     if(self)
         delete self;
+
+    self = nullptr;
 }
 #endif // IS_USE_STATIC
 
@@ -81,15 +87,12 @@ CInsim::CInsim ()
     // Initialize the mutex var
     ismutex = new std::mutex();
 
-    // Initialize global buffers
-    memset(gbuf.buffer, 0, PACKET_BUFFER_SIZE);
-    gbuf.bytes = 0;
-
     // Initialize local buffers
     memset(lbuf.buffer, 0, PACKET_BUFFER_SIZE);
     memset(udp_lbuf.buffer, 0, PACKET_BUFFER_SIZE);
     lbuf.bytes = 0;
     udp_lbuf.bytes = 0;
+    cur_size = 0;
 
     // Initialize packet buffers
     memset(packet, 0, PACKET_MAX_SIZE);
@@ -97,6 +100,16 @@ CInsim::CInsim ()
 
     // By default we're not using UDP
     using_udp = 0;
+    sock = INVALID_SOCKET;
+    sockudp = INVALID_SOCKET;
+
+    // Instances connecting to the same host must not retry in lockstep
+    jitter.seed(std::random_device()());
+
+    // Allocated once, the built-in state never allocates afterwards
+    registry = new CInsimRegistry();
+    cars = new CInsimCars();
+    frames = new CInsimFrames();
 }
 
 CInsim::CInsim(const std::string hostname, const word port, const std::string name, const std::string password, byte prefix, word flags, word interval, word udpport, byte version)
@@ -104,15 +117,12 @@ CInsim::CInsim(const std::string hostname, const word port, const std::string na
     // Initialize the mutex var
     ismutex = new std::mutex();
 
-    // Initialize global buffers
-    memset(gbuf.buffer, 0, PACKET_BUFFER_SIZE);
-    gbuf.bytes = 0;
-
     // Initialize local buffers
     memset(lbuf.buffer, 0, PACKET_BUFFER_SIZE);
     memset(udp_lbuf.buffer, 0, PACKET_BUFFER_SIZE);
     lbuf.bytes = 0;
     udp_lbuf.bytes = 0;
+    cur_size = 0;
 
     // Initialize packet buffers
     memset(packet, 0, PACKET_MAX_SIZE);
@@ -120,6 +130,16 @@ CInsim::CInsim(const std::string hostname, const word port, const std::string na
 
     // By default we're not using UDP
     using_udp = 0;
+    sock = INVALID_SOCKET;
+    sockudp = INVALID_SOCKET;
+
+    // Instances connecting to the same host must not retry in lockstep
+    jitter.seed(std::random_device()());
+
+    // Allocated once, the built-in state never allocates afterwards
+    registry = new CInsimRegistry();
+    cars = new CInsimCars();
+    frames = new CInsimFrames();
 
      this->hostname = hostname;
      this->tcpPort = port;
@@ -148,11 +168,106 @@ CInsim::~CInsim ()
 {
     // Destroy the mutex var
     delete ismutex;
+    delete registry;
+    delete cars;
+    delete frames;
+
+    #ifdef CIS_LINUX
+    delete shm;
+    #endif
 }
+
+/**
+* Move constructor: takes over the connection of "other", which is left
+* without sockets and without mutex. It may only be destroyed or assigned to.
+*/
+CInsim::CInsim (CInsim&& other)
+{
+    sock = INVALID_SOCKET;
+    sockudp = INVALID_SOCKET;
+    swap(other);
+}
+
+CInsim& CInsim::operator= (CInsim&& other)
+{
+    if (this != &other)
+        swap(other);
+
+    return *this;
+}
+
+/**
+* Exchange the whole state (settings, sockets, buffers and mutex) of two instances
+*/
+void CInsim::swap (CInsim& other)
+{
+    std::swap(hostname, other.hostname);
+    std::swap(tcpPort, other.tcpPort);
+    std::swap(udpPort, other.udpPort);
+    std::swap(product, other.product);
+    std::swap(password, other.password);
+    std::swap(prefix, other.prefix);
+    std::swap(flags, other.flags);
+    std::swap(interval, other.interval);
+    std::swap(version, other.version);
+
+    std::swap(sendPackVer, other.sendPackVer);
+    std::swap(hostVersion, other.hostVersion);
+    std::swap(hostProduct, other.hostProduct);
+    std::swap(hostInSimVersion, other.hostInSimVersion);
+
+    std::swap(sock, other.sock);
+    std::swap(sockudp, other.sockudp);
+    std::swap(using_udp, other.using_udp);
+    std::swap(connected, other.connected);
+    std::swap(lbuf, other.lbuf);
+    std::swap(cur_size, other.cur_size);
+    std::swap(packet, other.packet);
+    std::swap(readfd, other.readfd);
+    std::swap(exceptfd, other.exceptfd);
+    std::swap(select_timeout, other.select_timeout);
+    std::swap(udp_lbuf, other.udp_lbuf);
+    std::swap(udp_packet, other.udp_packet);
+    std::swap(udp_readfd, other.udp_readfd);
+    std::swap(udp_exceptfd, other.udp_exceptfd);
+    std::swap(ismutex, other.ismutex);
+
+    packets_in = other.packets_in.exchange(packets_in);
+    bytes_in = other.bytes_in.exchange(bytes_in);
+    packets_out = other.packets_out.exchange(packets_out);
+    bytes_out = other.bytes_out.exchange(bytes_out);
+
+    std::swap(auto_reconnect, other.auto_reconnect);
+    std::swap(reconnect_min, other.reconnect_min);
+    std::swap(reconnect_max, other.reconnect_max);
+    std::swap(reconnect_attempts, other.reconnect_attempts);
+    std::swap(jitter, other.jitter);
+    std::swap(handshaking, other.handshaking);
+    std::swap(state_ready, other.state_ready);
+    std::swap(on_state_ready, other.on_state_ready);
+
+    std::swap(fast_start, other.fast_start);
+    std::swap(connect_timeout, other.connect_timeout);
+    std::swap(startup_requests, other.startup_requests);
+    std::swap(resync_pending, other.resync_pending);
+    std::swap(host_resolved, other.host_resolved);
+    std::swap(host_addr, other.host_addr);
+    std::swap(connecting, other.connecting);
+    std::swap(awaiting_ver, other.awaiting_ver);
+    std::swap(connect_deadline, other.connect_deadline);
+
+    #ifdef CIS_LINUX
+    std::swap(shm, other.shm);
+    #endif
+    std::swap(registry, other.registry);
+    std::swap(cars, other.cars);
+    std::swap(frames, other.frames);
+}
 
 CInsim* CInsim::setHost(const std::string hostname)
 {
     this->hostname = hostname;
+    this->host_resolved = false;
     return this;
 }
 
@@ -216,6 +331,19 @@ byte CInsim::getHostVersion()
     return this->hostInSimVersion;
 }
 
+/**
+* Return a snapshot of the throughput counters. Can be called from any thread
+*/
+struct insimStats CInsim::getStats()
+{
+    struct insimStats st;
+    st.packetsIn = packets_in;
+    st.bytesIn = bytes_in;
+    st.packetsOut = packets_out;
+    st.bytesOut = bytes_out;
+    return st;
+}
+
 
 /**
 * Initialize the socket and the Insim connection
@@ -233,11 +361,28 @@ int CInsim::init()
     }
     #endif
 
-    // Create the TCP socket - this defines the type of socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    // What we knew about the host is stale, resync() or the host's own packets will fill it again
+    registry->clear();
+    cars->clear();
+    frames->clear();
+    #ifdef CIS_LINUX
+    if (shm)
+        shm->clear();
+    #endif
 
-    // Could we get the socket handle? If not the OS might be too busy or has run out of available socket descriptors
-    if (sock == INVALID_SOCKET) {
+    #ifdef CIS_LINUX
+    // A path instead of a host name: we are a client of a local multiplexer
+    if (!this->hostname.empty() && this->hostname[0] == '/')
+        return init_local(this->fast_start);
+    #endif
+
+    struct sockaddr_in saddr;
+
+    if (open_tcp(&saddr) < 0)
+        return -1;
+
+    // Now the socket address structure is full, lets try to connect
+    if (connect_socket(&saddr) < 0) {
       #ifdef CIS_WINDOWS
       closesocket(sock);
       WSACleanup();
@@ -248,25 +393,24 @@ int CInsim::init()
       return -1;
     }
 
-    // Resolve the IP address
-    struct sockaddr_in saddr;
-    memset(&saddr, 0, sizeof(saddr));
-
-    saddr.sin_family = AF_INET;
-
-    struct hostent *hp;
-    hp = gethostbyname(this->hostname.c_str());
+	// If the user asked for NLP or MCI packets and defined an udpport
+	if (this->udpPort > 0 && open_udp() < 0)
+        return -1;
 
-    if (hp != NULL)
-      saddr.sin_addr.s_addr = *((unsigned long*)hp->h_addr);
-    else
-      saddr.sin_addr.s_addr = inet_addr(this->hostname.c_str());
+    return handshake(this->fast_start);
+}
 
-    // Set the port number in the socket structure - we convert it from host unsigned char order, to network
-    saddr.sin_port = htons(this->tcpPort);
+/**
+* Create the TCP socket and fill the address of the host
+* The name is only looked up once, reconnections reuse the cached address
+*/
+int CInsim::open_tcp(struct sockaddr_in* saddr)
+{
+    // Create the TCP socket - this defines the type of socket
+    sock = socket(AF_INET, SOCK_STREAM, 0);
 
-    // Now the socket address structure is full, lets try to connect
-    if (connect(sock, (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
+    // Could we get the socket handle? If not the OS might be too busy or has run out of available socket descriptors
+    if (sock == INVALID_SOCKET) {
       #ifdef CIS_WINDOWS
       closesocket(sock);
       WSACleanup();
@@ -277,67 +421,134 @@ int CInsim::init()
       return -1;
     }
 
-	// If the user asked for NLP or MCI packets and defined an udpport
-	if (this->udpPort > 0) {
-        // Create the UDP socket - this defines the type of socket
-        sockudp = socket(AF_INET, SOCK_DGRAM, 0);
+    // Resolve the IP address
+    memset(saddr, 0, sizeof(*saddr));
 
-        // Could we get the socket handle? If not the OS might be too busy or have run out of available socket descriptors
-        if (sockudp == INVALID_SOCKET) {
-            #ifdef CIS_WINDOWS
-            closesocket(sock);
-            closesocket(sockudp);
-            WSACleanup();
-            #elif defined CIS_LINUX
-            close(sock);
-            close(sockudp);
-            #endif
-            return -1;
+    saddr->sin_family = AF_INET;
+
+    if (!host_resolved) {
+        struct hostent *hp;
+        hp = gethostbyname(this->hostname.c_str());
+
+        if (hp != NULL) {
+            memcpy(&host_addr, hp->h_addr, sizeof(host_addr));
+            host_resolved = true;
         }
+        else {
+            host_addr.s_addr = inet_addr(this->hostname.c_str());
+            host_resolved = (host_addr.s_addr != INADDR_NONE);
+        }
+    }
 
-        // Resolve the IP address
-        struct sockaddr_in udp_saddr, my_addr;
-        memset(&udp_saddr, 0, sizeof(udp_saddr));
-        memset(&my_addr, 0, sizeof(my_addr));
+    saddr->sin_addr = host_addr;
 
-        // Bind the UDP socket to my specified udpport and address
-        my_addr.sin_family = AF_INET;         // host unsigned char order
-        my_addr.sin_port = htons(this->udpPort);     // short, network unsigned char order
-        my_addr.sin_addr.s_addr = INADDR_ANY;
-        memset(my_addr.sin_zero, '\0', sizeof my_addr.sin_zero);
+    // Set the port number in the socket structure - we convert it from host unsigned char order, to network
+    saddr->sin_port = htons(this->tcpPort);
 
-        // don't forget your error checking for bind():
-        bind(sockudp, (struct sockaddr *)&my_addr, sizeof my_addr);
+    return 0;
+}
 
-        // Set the server address and the connect to it
-        udp_saddr.sin_family = AF_INET;
+/**
+* Open the UDP socket for NLP and MCI packets. On failure both sockets are closed
+*/
+int CInsim::open_udp()
+{
+    // Create the UDP socket - this defines the type of socket
+    sockudp = socket(AF_INET, SOCK_DGRAM, 0);
 
+    // Could we get the socket handle? If not the OS might be too busy or have run out of available socket descriptors
+    if (sockudp == INVALID_SOCKET) {
+        #ifdef CIS_WINDOWS
+        closesocket(sock);
+        closesocket(sockudp);
+        WSACleanup();
+        #elif defined CIS_LINUX
+        close(sock);
+        close(sockudp);
+        #endif
+        return -1;
+    }
 
-        if (hp != NULL)
-            udp_saddr.sin_addr.s_addr = *((unsigned long*)hp->h_addr);
-        else
-            udp_saddr.sin_addr.s_addr = inet_addr(this->hostname.c_str());
+    // Resolve the IP address
+    struct sockaddr_in udp_saddr, my_addr;
+    memset(&udp_saddr, 0, sizeof(udp_saddr));
+    memset(&my_addr, 0, sizeof(my_addr));
 
-        // Set the UDP port number in the UDP socket structure - we convert it from host unsigned char order, to network
-        udp_saddr.sin_port = htons(this->udpPort);
+    // Bind the UDP socket to my specified udpport and address
+    my_addr.sin_family = AF_INET;         // host unsigned char order
+    my_addr.sin_port = htons(this->udpPort);     // short, network unsigned char order
+    my_addr.sin_addr.s_addr = INADDR_ANY;
+    memset(my_addr.sin_zero, '\0', sizeof my_addr.sin_zero);
 
-        // Connect the UDP using the same address as in the TCP socket
-        if (connect(sockudp, (struct sockaddr *) &udp_saddr, sizeof(udp_saddr)) < 0) {
-            #ifdef CIS_WINDOWS
-            closesocket(sock);
-            closesocket(sockudp);
-            WSACleanup();
-            #elif defined CIS_LINUX
-            close(sock);
-            close(sockudp);
-            #endif
-            return -1;
-        }
+    // don't forget your error checking for bind():
+    bind(sockudp, (struct sockaddr *)&my_addr, sizeof my_addr);
 
-	    // We are using UDP!
-	    using_udp = 1;
-	}
+    // Set the server address and the connect to it
+    udp_saddr.sin_family = AF_INET;
+
+
+    udp_saddr.sin_addr = host_addr;
+
+    // Set the UDP port number in the UDP socket structure - we convert it from host unsigned char order, to network
+    udp_saddr.sin_port = htons(this->udpPort);
+
+    // Connect the UDP using the same address as in the TCP socket
+    if (connect(sockudp, (struct sockaddr *) &udp_saddr, sizeof(udp_saddr)) < 0) {
+        #ifdef CIS_WINDOWS
+        closesocket(sock);
+        closesocket(sockudp);
+        WSACleanup();
+        #elif defined CIS_LINUX
+        close(sock);
+        close(sockudp);
+        #endif
+        return -1;
+    }
+
+    // We are using UDP!
+    using_udp = 1;
+    return 0;
+}
+
+#ifdef CIS_LINUX
+/**
+* Connect to a local InSim multiplexer (see CInsimMux) listening on the UNIX socket "hostname"
+* NLP and MCI packets come through the same socket, no UDP socket is opened
+*/
+int CInsim::init_local(bool pipelined)
+{
+    struct sockaddr_un saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sun_family = AF_UNIX;
+
+    if (this->hostname.size() >= sizeof(saddr.sun_path))
+        return -1;
+
+    strcpy(saddr.sun_path, this->hostname.c_str());
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (sock == INVALID_SOCKET)
+        return -1;
+
+    if (connect(sock, (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    using_udp = 0;
 
+    return handshake(pipelined);
+}
+#endif
+
+/**
+* Say hello to InSim on the freshly connected socket(s) and wait for IS_VER if requested
+* Pipelined (fast start and reconnectStart()), the IS_ISI leaves in a single send() with the
+* startup requests and a pending resync burst, and IS_VER is awaited by poll_packet() instead
+*/
+int CInsim::handshake(bool pipelined)
+{
     // Ok, so we're connected. First we need to let LFS know we're here by sending the IS_ISI packet
 	struct IS_ISI isi_p;
 	memset(&isi_p, 0, sizeof(struct IS_ISI));
@@ -355,7 +566,8 @@ int CInsim::init()
 	memcpy(isi_p.Admin, this->password.c_str(), 16);
 
     // Send the initialization packet
-    if(send_packet(&isi_p) < 0) {
+    // In fast start mode it leaves in the same send() as the startup requests, without waiting for IS_VER
+    if((pipelined ? send_first_flush(&isi_p) : send_packet(&isi_p)) < 0) {
         if (using_udp) {
             #ifdef CIS_WINDOWS
             closesocket(sockudp);
@@ -381,56 +593,33 @@ int CInsim::init()
     select_timeout.tv_nsec = 0;
     #endif
 
+    connected = true;
+
+    // Pipelined, poll_packet() handles IS_VER when it arrives, and reconnectStep() gives up if it doesn't
+    if (this->sendPackVer && pipelined)
+    {
+        awaiting_ver = true;
+        connect_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(this->connect_timeout);
+    }
+
     // If an IS_VER packet was requested
-    if (this->sendPackVer)
+    if (this->sendPackVer && !pipelined)
     {
-        if (next_packet() < 0) {             // Get next packet, supposed to be an IS_VER
-            if (disconnect() < 0) {
-                if (using_udp) {
-                    #ifdef CIS_WINDOWS
-                    closesocket(sockudp);
-                    #elif defined CIS_LINUX
-                    close(sockudp);
-                    #endif
-                }
-
-                #ifdef CIS_WINDOWS
-                closesocket(sock);
-                WSACleanup();
-                #elif defined CIS_LINUX
-                close(sock);
-                #endif
-                return -1;
-            }
+        handshaking = true;
+        int rc = next_packet();
+        handshaking = false;
+
+        if (rc < 0) {                       // Get next packet, supposed to be an IS_VER
+            disconnect();                   // Closes the sockets even if TINY_CLOSE can't be sent
             return -1;
         }
 
         switch (peek_packet())              // Check if the packet returned was an IS_VER
         {
-            case ISP_VER:                    // It was, get it!
-                IS_VER packVer;
-                memcpy(&packVer, (struct IS_VER*)get_packet(), sizeof(struct IS_VER));
-                this->hostProduct = packVer.Product;
-                this->hostVersion = packVer.Version;
-                this->hostInSimVersion = packVer.InSimVer;
+            case ISP_VER:                    // It was, poll_packet() already got it
                 break;
             default:                          // It wasn't, something went wrong. Quit
-                if (disconnect() < 0) {
-                    if (using_udp) {
-                        #ifdef CIS_WINDOWS
-                        closesocket(sockudp);
-                        #elif defined CIS_LINUX
-                        close(sockudp);
-                        #endif
-                    }
-
-                    #ifdef CIS_WINDOWS
-                    closesocket(sock);
-                    WSACleanup();
-                    #elif defined CIS_LINUX
-                    close(sock);
-                    #endif
-                }
+                disconnect();
                 return -1;
         }
     }
@@ -448,8 +637,8 @@ int CInsim::disconnect()
     cl_packet.ReqI = 0;
     cl_packet.SubT = TINY_CLOSE;
 
-    if (send_packet(&cl_packet) < 0)
-        return -1;
+    // The sockets are closed even if the other end is already gone
+    int rc = send_packet(&cl_packet) < 0 ? -1 : 0;
 
     if (using_udp) {
         #ifdef CIS_WINDOWS
@@ -465,7 +654,16 @@ int CInsim::disconnect()
     #elif defined CIS_LINUX
     close(sock);
     #endif
-    return 0;
+
+    sock = INVALID_SOCKET;
+    sockudp = INVALID_SOCKET;
+    using_udp = 0;
+    connected = false;
+    connecting = false;
+    awaiting_ver = false;
+    lbuf.bytes = 0;
+    cur_size = 0;
+    return rc;
 }
 
 /**
@@ -474,115 +672,150 @@ int CInsim::disconnect()
 */
 int CInsim::next_packet()
 {
-    unsigned short oldp_size, p_size;
-    bool alive = true;
-
-    while (alive)                                               // Keep the connection alive!
+    while (true)
     {
-        alive = false;
-        oldp_size = (unsigned char)*lbuf.buffer;
-
-        if (this->version > 8) {
-            oldp_size *= 4;
-        }
+        // Is there a full packet already waiting in the local buffer?
+        int rc = poll_packet();
 
-        if ((lbuf.bytes > 0) && (lbuf.bytes >= oldp_size)) {        // There's an old packet in the local buffer, skip it
-            // Copy the leftovers from local buffer to global buffer
-            memcpy(gbuf.buffer, lbuf.buffer+oldp_size, lbuf.bytes-oldp_size);
-            gbuf.bytes = lbuf.bytes - oldp_size;
+        if (rc < 0)
+            return -1;
 
-            // Copy from global buffer back to the beginning of local buffer
-            memset(lbuf.buffer, 0, PACKET_BUFFER_SIZE);
-            memcpy(lbuf.buffer, gbuf.buffer, gbuf.bytes);
-            lbuf.bytes = gbuf.bytes;
-        }
+        if (rc > 0)
+            return 0;
 
-        p_size = (unsigned char)*lbuf.buffer;
-
-        if (this->version > 8) {
-            p_size *= 4;
-        }
+        // Read until we have a full packet
+        // Clear them
+        FD_ZERO(&readfd);
+        FD_ZERO(&exceptfd);
 
-        while ((lbuf.bytes < p_size) || (lbuf.bytes < 1))       // Read until we have a full packet
-        {
-            // Clear them
-            FD_ZERO(&readfd);
-            FD_ZERO(&exceptfd);
+        // Set them to watch our socket for data to read and exceptions that maybe thrown
+        FD_SET(sock, &readfd);
+        FD_SET(sock, &exceptfd);
 
-            // Set them to watch our socket for data to read and exceptions that maybe thrown
-            FD_SET(sock, &readfd);
-            FD_SET(sock, &exceptfd);
+        #ifdef CIS_WINDOWS
+        rc = select(0, &readfd, NULL, &exceptfd, &select_timeout);
+        #elif defined CIS_LINUX
+        rc = pselect(sock + 1, &readfd, NULL, &exceptfd, &select_timeout, NULL);
+        #endif
 
-            #ifdef CIS_WINDOWS
-            int rc = select(0, &readfd, NULL, &exceptfd, &select_timeout);
-            #elif defined CIS_LINUX
-            int rc = pselect(sock + 1, &readfd, NULL, &exceptfd, &select_timeout, NULL);
-            #endif
+        // Timeout
+        if (rc == 0)
+        {
+            #ifdef IS_DEBUG
+            std::cout << "CInsim::next_packet - Timeout" << std::endl;
+            #endif // IS_DEBUG
 
-            // Timeout
-            if (rc == 0)
-            {
-                #ifdef IS_DEBUG
-                std::cout << "CInsim::next_packet - Timeout" << std::endl;
-                #endif // IS_DEBUG
-                continue;
-            }
-            // An error occured
-            if (rc < 0)
-            {
-                #ifdef IS_DEBUG
-                std::cout << "CInsim::next_packet - An error occured" << std::endl;
-                #endif // IS_DEBUG
+            // init() doesn't wait for IS_VER forever
+            if (handshaking)
                 return -1;
-            }
+            continue;
+        }
+        // An error occured
+        if (rc < 0)
+        {
+            #ifdef IS_DEBUG
+            std::cout << "CInsim::next_packet - An error occured" << std::endl;
+            #endif // IS_DEBUG
+        }
+        // An exception occured - we want to quit
+        else if (FD_ISSET(sock, &exceptfd))
+        {
+            #ifdef IS_DEBUG
+            std::cout << "CInsim::next_packet - An exception occured - we want to quit" << std::endl;
+            #endif // IS_DEBUG
+            rc = -1;
+        }
+        // We got data!
+        else
+        {
+            rc = recv_data();
+        }
 
-            // An exception occured - we want to quit
-            if (FD_ISSET(sock, &exceptfd))
-            {
-                #ifdef IS_DEBUG
-                std::cout << "CInsim::next_packet - An exception occured - we want to quit" << std::endl;
-                #endif // IS_DEBUG
+        if (rc < 0)
+        {
+            if (!auto_reconnect || handshaking)
+                return rc;
+
+            if (wait_reconnect() < 0)
                 return -1;
-            }
-            else
-            {  // We got data!
-                // Recieve any waiting bytes
-                int retval = recv(sock, lbuf.buffer + lbuf.bytes, PACKET_BUFFER_SIZE - lbuf.bytes, 0);
-
-                // Deal with the results
-
-                // Connection has been closed at the other end
-                if (retval == 0)
-                {
-                    #ifdef IS_DEBUG
-                    std::cout << "CInsim::next_packet - Connection has been closed at the other end" << std::endl;
-                    #endif // IS_DEBUG
-                    return -2;
-                }
-
-                // An error ocurred
-                if (retval < 0)
-                {
-                    #ifdef IS_DEBUG
-                    std::cout << "CInsim::next_packet - An error ocurred" << std::endl;
-                    #endif // IS_DEBUG
-                    return -1;
-                }
-
-
-                p_size = *lbuf.buffer;
-                if (this->version > 8) {
-                    p_size *= 4;
-                }
-                lbuf.bytes += retval;
-            }
         }
+    }
+}
+
+/**
+* Receive whatever is waiting on the TCP socket with a single recv() call
+* It only blocks if nothing is waiting, so call it once select() reports the socket as readable
+* Returns the number of bytes read, -2 if the connection has been closed at the other end or -1 on error
+*/
+int CInsim::recv_data()
+{
+    // Recieve any waiting bytes
+    int retval = recv(sock, lbuf.buffer + lbuf.bytes, PACKET_BUFFER_SIZE - lbuf.bytes, 0);
+
+    // Deal with the results
+
+    // Connection has been closed at the other end
+    if (retval == 0)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsim::recv_data - Connection has been closed at the other end" << std::endl;
+        #endif // IS_DEBUG
+        return -2;
+    }
+
+    // An error ocurred
+    if (retval < 0)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsim::recv_data - An error ocurred" << std::endl;
+        #endif // IS_DEBUG
+        return -1;
+    }
+
+    lbuf.bytes += retval;
+    bytes_in += retval;
+    return retval;
+}
+
+/**
+* Get the next packet ready from the data already received, without touching the socket
+* Keep alive packets are answered and skipped
+* Returns 1 if a packet is ready in "char packet[]", 0 if more data is needed or -1 on error
+*/
+int CInsim::poll_packet()
+{
+    while (true)
+    {
+        if (cur_size > 0) {                                     // There's an old packet in the local buffer, skip it
+            memmove(lbuf.buffer, lbuf.buffer + cur_size, lbuf.bytes - cur_size);
+            lbuf.bytes -= cur_size;
+            cur_size = 0;
+        }
+
+        if (lbuf.bytes < 1)
+            return 0;
+
+        unsigned short p_size = (unsigned char)*lbuf.buffer;
+
+        if (this->version > 8) {
+            p_size *= 4;
+        }
+
+        if (p_size == 0) {                                      // Corrupted stream, we can't resynchronise
+            #ifdef IS_DEBUG
+            std::cout << "CInsim::poll_packet - Zero sized packet" << std::endl;
+            #endif // IS_DEBUG
+            return -1;
+        }
+
+        if (lbuf.bytes < p_size)                                // Not a full packet yet
+            return 0;
 
         memcpy(packet, lbuf.buffer, p_size);
+        cur_size = p_size;
+        packets_in++;
 
         if ((peek_packet() == ISP_TINY) && (*(packet+3) == TINY_NONE)) {
-            alive = true;
-
             struct IS_TINY keepalive;
             keepalive.Size = sizeof(struct IS_TINY);
             keepalive.Type = ISP_TINY;
@@ -593,16 +826,83 @@ int CInsim::next_packet()
             if (send_packet(&keepalive) < 0)
             {
                 #ifdef IS_DEBUG
-                std::cout << "CInsim::next_packet - An error ocurred at send keep alive packet" << std::endl;
+                std::cout << "CInsim::poll_packet - An error ocurred at send keep alive packet" << std::endl;
                 #endif // IS_DEBUG
                 return -1;
             }
+            continue;
+        }
+
+        // Keep the host version up to date, whoever requested it
+        if (peek_packet() == ISP_VER) {
+            IS_VER packVer;
+            memcpy(&packVer, (struct IS_VER*)get_packet(), sizeof(struct IS_VER));
+            this->hostProduct = std::string(packVer.Product, strnlen(packVer.Product, sizeof(packVer.Product)));
+            this->hostVersion = std::string(packVer.Version, strnlen(packVer.Version, sizeof(packVer.Version)));
+            this->hostInSimVersion = packVer.InSimVer;
+
+            // A pipelined handshake is only complete now
+            if (awaiting_ver) {
+                awaiting_ver = false;
+                reconnect_attempts = 0;
+            }
+        }
+
+        // The reply to the ping closing a resync() burst: everything requested before it has arrived
+        if ((peek_packet() == ISP_TINY) && (*(packet+3) == TINY_REPLY) && ((byte)*(packet+2) == IS_RESYNC_REQI)) {
+            state_ready = true;
 
+            if (on_state_ready)
+                on_state_ready(this);
+            continue;
         }
+
+        track(packet);
+        return 1;
+    }
+}
+
+/**
+* Keep the built-in state up to date with a packet we are about to hand out
+*/
+void CInsim::track(void* packet)
+{
+    if (registry)
+        registry->update(packet);
+
+    if (cars)
+        cars->update(packet);
+
+    if (frames)
+        frames->update(packet);
+
+    #ifdef CIS_LINUX
+    if (shm)
+        shm->update(packet);
+    #endif
+}
+
+#ifdef CIS_LINUX
+int CInsim::publishState(const std::string name)
+{
+    delete shm;
+    shm = nullptr;
+
+    if (name.empty())
+        return 0;
+
+    shm = new CInsimShm();
+
+    if (shm->open(name) < 0)
+    {
+        delete shm;
+        shm = nullptr;
+        return -1;
     }
 
     return 0;
 }
+#endif
 
 /**
 * Return the type of the next packet
@@ -629,12 +929,8 @@ void* CInsim::get_packet()
 */
 int CInsim::udp_next_packet()
 {
-    // Clear the local buffer
-    memset(udp_lbuf.buffer, 0, PACKET_BUFFER_SIZE);
-    udp_lbuf.bytes = 0;
-
     // Read until we have a full packet
-    while (udp_lbuf.bytes < 1)
+    while (true)
     {
         // Clear them
         FD_ZERO(&udp_readfd);
@@ -658,23 +954,40 @@ int CInsim::udp_next_packet()
 
         if (FD_ISSET(sockudp, &udp_exceptfd))    // An exception occured - we want to quit
             return -1;
-        else  // We got data!
-        {
-            // Recieve any waiting bytes
-            int retval = recv(sockudp, udp_lbuf.buffer + udp_lbuf.bytes, PACKET_BUFFER_SIZE - udp_lbuf.bytes, 0);
 
-            // Deal with the results
-            if (retval < 0)                 // An error ocurred
-                return -1;
-
-            udp_lbuf.bytes += retval;
-        }
+        // We got data!
+        rc = udp_recv_packet();
 
+        if (rc != 0)
+            return rc < 0 ? -1 : 0;
     }
+}
+
+/**
+* Receive a single datagram from the UDP socket into "char udp_packet[]"
+* Like recv_data(), it only blocks if nothing is waiting
+* Returns 1 if a packet is ready, 0 if the datagram was empty or -1 on error
+*/
+int CInsim::udp_recv_packet()
+{
+    // Recieve any waiting bytes
+    int retval = recv(sockudp, udp_lbuf.buffer, PACKET_BUFFER_SIZE, 0);
 
-    memcpy(udp_packet, udp_lbuf.buffer, (unsigned char)*udp_lbuf.buffer);
+    // Deal with the results
+    if (retval < 0)                 // An error ocurred
+        return -1;
 
-    return 0;
+    udp_lbuf.bytes = retval;
+
+    if (retval < 1)
+        return 0;
+
+    memcpy(udp_packet, udp_lbuf.buffer, udp_lbuf.bytes);
+    bytes_in += retval;
+    packets_in++;
+    track(udp_packet);
+
+    return 1;
 }
 
 
@@ -703,6 +1016,50 @@ int CInsim::send_packet(void* s_packet)
 {
     ismutex->lock();
 
+    if (prepare_packet(s_packet) < 0)
+    {
+        ismutex->unlock();
+        return -1;
+    }
+
+    size_t psize = *((unsigned char*)s_packet);
+
+    if(this->version > 8) {
+        *((unsigned char*)s_packet) = psize / 4;
+    }
+
+    if (send_bytes((const char *)s_packet, psize) < 0)
+    {
+        ismutex->unlock();
+        return -1;
+    }
+    packets_out++;
+    ismutex->unlock();
+    return 0;
+}
+
+/**
+* Send data already encoded (Size byte included) as is, e.g. packets relayed from another connection
+*/
+int CInsim::send_raw(const void* data, size_t len)
+{
+    ismutex->lock();
+
+    if (send_bytes((const char *)data, len) < 0)
+    {
+        ismutex->unlock();
+        return -1;
+    }
+    packets_out++;
+    ismutex->unlock();
+    return 0;
+}
+
+/**
+* Set the real size (in bytes) of variable sized packets before sending them
+*/
+int CInsim::prepare_packet(void* s_packet)
+{
     //Detect packet type
     switch(*((unsigned char*)s_packet+1))
     {
@@ -716,10 +1073,7 @@ int CInsim::send_packet(void* s_packet)
             * If we discard the packet, perhaps another
             * return code should be used. */
             if(text_len > IS_BTN_MAXTLEN)
-            {
-                ismutex->unlock();
                 return -1;
-            }
 
             unsigned char texttosend;
             unsigned char remdr = text_len % 4;
@@ -740,10 +1094,7 @@ int CInsim::send_packet(void* s_packet)
 
             //Same as above
             if(text_len > IS_MTC_MAXTLEN)
-            {
-                ismutex->unlock();
                 return -1;
-            }
 
             unsigned char texttosend = text_len + 4 - text_len % 4;
 
@@ -755,21 +1106,482 @@ int CInsim::send_packet(void* s_packet)
             break;
     }
 
-    size_t psize = *((unsigned char*)s_packet);
-
-    if(this->version > 8) {
-        *((unsigned char*)s_packet) = psize / 4;
+    return 0;
+}
+
+/**
+* Send raw (already encoded) data. The caller must hold ismutex
+*/
+int CInsim::send_bytes(const char* data, size_t len)
+{
+    #ifdef CIS_WINDOWS
+    if (send(sock, data, len, 0) < 0)
+    #elif defined CIS_LINUX
+    if (send(sock, data, len, MSG_NOSIGNAL) < 0)    // Don't get killed by SIGPIPE if the host went away
+    #endif
+        return -1;
+
+    bytes_out += len;
+    return 0;
+}
+
+CInsim* CInsim::setReconnect(bool enable, unsigned minDelay, unsigned maxDelay)
+{
+    if (minDelay == 0 || maxDelay < minDelay) {
+        throw new std::logic_error("Reconnect delays must be non-zero and minDelay <= maxDelay");
     }
+    this->auto_reconnect = enable;
+    this->reconnect_min = minDelay;
+    this->reconnect_max = maxDelay;
+    return this;
+}
+
+CInsim* CInsim::setStateReadyCallback(std::function<void (CInsim*)> func)
+{
+    this->on_state_ready = func;
+    return this;
+}
+
+/**
+* Delay before the next reconnection attempt: exponential backoff from reconnect_min
+* up to reconnect_max, with a random value in the upper half of the interval so that
+* several instances don't hammer a restarting host at the same instant
+*/
+unsigned CInsim::reconnectDelay()
+{
+    unsigned long long delay = reconnect_min;
+
+    for (unsigned i = 0; i < reconnect_attempts && delay < reconnect_max; i++)
+        delay *= 2;
+
+    if (delay > reconnect_max)
+        delay = reconnect_max;
+
+    std::uniform_int_distribution<unsigned> dist(delay / 2, delay);
+    return dist(jitter);
+}
+
+/**
+* Try once to get the connection back: close whatever is left of the old one,
+* init() again and pipeline the state requests
+* Returns 0 on success, -1 if the host can't be reached yet
+*/
+int CInsim::reconnect()
+{
+    if (connected)
+        disconnect();
+
+    state_ready = false;
+
+    // In fast start mode the resync burst leaves together with the IS_ISI
+    resync_pending = this->fast_start;
+
+    if (init() < 0) {
+        resync_pending = false;
+        reconnect_attempts++;
+        return -1;
+    }
+
+    if (!awaiting_ver)
+        reconnect_attempts = 0;
+
+    if (this->fast_start)
+        return 0;
+
+    return resync();
+}
+
+/**
+* Start a reconnection without blocking: the TCP connection is only initiated here,
+* reconnectStep() completes it once the socket is writable
+*/
+int CInsim::reconnectStart()
+{
+    if (connected || connecting)
+        disconnect();
+
+    state_ready = false;
+
+    // The resync burst leaves together with the IS_ISI
+    resync_pending = true;
+
+    #ifdef CIS_WINDOWS
+    WSADATA wsadata;
+    if (WSAStartup(0x202, &wsadata) == SOCKET_ERROR) {
+      WSACleanup();
+      resync_pending = false;
+      reconnect_attempts++;
+      return -1;
+    }
+    #endif
 
-    if (send(sock, (const char *)s_packet, psize, 0) < 0)
+    registry->clear();
+    cars->clear();
+    frames->clear();
+    #ifdef CIS_LINUX
+    if (shm)
+        shm->clear();
+    #endif
+
+    int rc;
+
+    #ifdef CIS_LINUX
+    // Connecting to a local multiplexer doesn't wait
+    if (!this->hostname.empty() && this->hostname[0] == '/')
+        rc = init_local(true);
+    else
+    #endif
     {
-        ismutex->unlock();
+        struct sockaddr_in saddr;
+
+        if (open_tcp(&saddr) < 0) {
+            resync_pending = false;
+            reconnect_attempts++;
+            return -1;
+        }
+
+        rc = start_connect(&saddr);
+
+        if (rc < 0) {
+            abort_connect();
+            return -1;
+        }
+
+        if (rc == 0) {
+            connecting = true;
+            connect_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(this->connect_timeout);
+            return 0;
+        }
+
+        // Already connected (e.g. to localhost)
+        rc = (this->udpPort > 0 && open_udp() < 0) ? -1 : handshake(true);
+    }
+
+    if (rc < 0) {
+        resync_pending = false;
+        reconnect_attempts++;
         return -1;
     }
+
+    if (!awaiting_ver)
+        reconnect_attempts = 0;
+
+    return awaiting_ver ? 0 : 1;
+}
+
+/**
+* Go on with a reconnectStart(): finish the TCP connection if the socket is writable,
+* or give up if the connection or the IS_VER reply takes longer than connect_timeout
+*/
+int CInsim::reconnectStep()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (connecting)
+    {
+        int rc = connect_wait(0);
+
+        if (rc == 0 && now < connect_deadline)
+            return 0;
+
+        if (rc <= 0)
+        {
+            #ifdef IS_DEBUG
+            std::cout << "CInsim::reconnectStep - Could not connect in time" << std::endl;
+            #endif // IS_DEBUG
+            abort_connect();
+            return -1;
+        }
+
+        connecting = false;
+
+        if ((this->udpPort > 0 && open_udp() < 0) || handshake(true) < 0)
+        {
+            resync_pending = false;
+            sock = INVALID_SOCKET;
+            sockudp = INVALID_SOCKET;
+            using_udp = 0;
+            reconnect_attempts++;
+            return -1;
+        }
+
+        if (!awaiting_ver)
+            reconnect_attempts = 0;
+
+        return awaiting_ver ? 0 : 1;
+    }
+
+    if (awaiting_ver)
+    {
+        if (now < connect_deadline)
+            return 0;
+
+        #ifdef IS_DEBUG
+        std::cout << "CInsim::reconnectStep - No IS_VER in time" << std::endl;
+        #endif // IS_DEBUG
+        disconnect();
+        reconnect_attempts++;
+        return -1;
+    }
+
+    return connected ? 1 : -1;
+}
+
+int CInsim::connectWait()
+{
+    if (!connecting && !awaiting_ver)
+        return -1;
+
+    long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(connect_deadline - std::chrono::steady_clock::now()).count();
+    return wait < 0 ? 0 : (int)wait;
+}
+
+/**
+* Close the socket of a connection attempt that failed
+*/
+void CInsim::abort_connect()
+{
+    #ifdef CIS_WINDOWS
+    closesocket(sock);
+    WSACleanup();
+    #elif defined CIS_LINUX
+    close(sock);
+    #endif
+
+    sock = INVALID_SOCKET;
+    connecting = false;
+    resync_pending = false;
+    reconnect_attempts++;
+}
+
+/**
+* Block until the connection is back (used by next_packet() when auto reconnection is on)
+*/
+int CInsim::wait_reconnect()
+{
+    if (connected)
+        disconnect();
+
+    while (true)
+    {
+        unsigned delay = reconnectDelay();
+
+        #ifdef IS_DEBUG
+        std::cout << "CInsim::wait_reconnect - Connection lost, retrying in " << delay << " ms" << std::endl;
+        #endif // IS_DEBUG
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+        if (reconnect() == 0)
+            return 0;
+    }
+}
+
+/**
+* Request the whole host state in one burst: connections, players, race start,
+* state, layout objects and selected cars, closed by a TINY_PING
+* LFS answers in order, so the TINY_REPLY to the ping arrives after all the other
+* replies. isStateReady() becomes true (and the callback is called) at that moment
+*/
+int CInsim::resync()
+{
+    std::string burst;
+    unsigned count = resync_burst(burst);
+
+    state_ready = false;
+
+    // A single send() for the whole burst
+    ismutex->lock();
+    int rc = send_bytes(burst.data(), burst.size());
+    if (rc == 0)
+        packets_out += count;
     ismutex->unlock();
+
+    return rc;
+}
+
+/**
+* Append the (encoded) resync() requests to "out". Returns the number of packets
+*/
+unsigned CInsim::resync_burst(std::string& out)
+{
+    static const byte requests[] = { TINY_NCN, TINY_NPL, TINY_RST, TINY_SST, TINY_AXM, TINY_SLC, TINY_PING };
+    const unsigned count = sizeof(requests) / sizeof(requests[0]);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        struct IS_TINY tiny;
+        tiny.Size = this->version > 8 ? sizeof(struct IS_TINY) / 4 : sizeof(struct IS_TINY);
+        tiny.Type = ISP_TINY;
+        tiny.ReqI = IS_RESYNC_REQI;
+        tiny.SubT = requests[i];
+        out.append((const char *)&tiny, sizeof(tiny));
+    }
+
+    return count;
+}
+
+CInsim* CInsim::setFastStart(bool enable, unsigned connectTimeout)
+{
+    this->fast_start = enable;
+    this->connect_timeout = connectTimeout;
+    return this;
+}
+
+/**
+* Register a packet to be sent right after the IS_ISI, in the same send(), on every
+* init() in fast start mode. The packet is copied, it can be discarded afterwards
+*/
+int CInsim::addStartupRequest(void* s_packet)
+{
+    if (prepare_packet(s_packet) < 0)
+        return -1;
+
+    startup_requests.push_back(std::string((const char *)s_packet, *((unsigned char*)s_packet)));
     return 0;
 }
 
+void CInsim::clearStartupRequests()
+{
+    startup_requests.clear();
+}
+
+/**
+* Send the IS_ISI, the startup requests and a pending resync burst with a single send()
+*/
+int CInsim::send_first_flush(struct IS_ISI* isi_p)
+{
+    std::string flush((const char *)isi_p, sizeof(struct IS_ISI));
+    unsigned count = 1;
+
+    for (size_t i = 0; i < startup_requests.size(); i++)
+    {
+        flush += startup_requests[i];
+        count++;
+    }
+
+    if (this->version > 8)      // Sizes were stored in bytes
+    {
+        size_t offset = 0;
+        while (offset < flush.size())
+        {
+            unsigned char psize = flush[offset];
+            flush[offset] = psize / 4;
+            offset += psize;
+        }
+    }
+
+    if (resync_pending)
+    {
+        count += resync_burst(flush);
+        resync_pending = false;
+    }
+
+    ismutex->lock();
+    int rc = send_bytes(flush.data(), flush.size());
+    if (rc == 0)
+        packets_out += count;
+    ismutex->unlock();
+
+    return rc;
+}
+
+/**
+* Connect the TCP socket, giving up after connect_timeout ms
+*/
+int CInsim::connect_socket(struct sockaddr_in* saddr)
+{
+    int rc = start_connect(saddr);
+
+    if (rc == 0)
+        rc = connect_wait(this->connect_timeout);
+
+    if (rc <= 0)                // Timeout or error
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsim::connect_socket - Could not connect in time" << std::endl;
+        #endif // IS_DEBUG
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Initiate the TCP connection without blocking
+* Returns 1 if connected already (the socket is blocking again), 0 if in progress or -1 on error
+*/
+int CInsim::start_connect(struct sockaddr_in* saddr)
+{
+    // Small requests must not be held back by Nagle's algorithm
+    if (this->fast_start) {
+        int nodelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+    }
+
+    #ifdef CIS_WINDOWS
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+
+    if (connect(sock, (struct sockaddr *) saddr, sizeof(*saddr)) == SOCKET_ERROR)
+        return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+
+    nonblock = 0;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+    #elif defined CIS_LINUX
+    int fl = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, fl | O_NONBLOCK);
+
+    if (connect(sock, (struct sockaddr *) saddr, sizeof(*saddr)) < 0)
+        return errno == EINPROGRESS ? 0 : -1;
+
+    fcntl(sock, F_SETFL, fl);
+    #endif
+
+    return 1;
+}
+
+/**
+* Wait up to timeout_ms for a connection started by start_connect()
+* Returns 1 once connected (the socket is blocking again), 0 if still in progress or -1 if it failed
+*/
+int CInsim::connect_wait(int timeout_ms)
+{
+    fd_set writefd, errfd;
+    FD_ZERO(&writefd);
+    FD_ZERO(&errfd);
+    FD_SET(sock, &writefd);
+    FD_SET(sock, &errfd);
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    #ifdef CIS_WINDOWS
+    int rc = select(0, NULL, &writefd, &errfd, &tv);
+    #elif defined CIS_LINUX
+    int rc = select(sock + 1, NULL, &writefd, &errfd, &tv);
+    #endif
+
+    if (rc <= 0)
+        return rc;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0 || err != 0)
+        return -1;
+
+    // Back to blocking mode, the rest of the library relies on it
+    #ifdef CIS_WINDOWS
+    u_long nonblock = 0;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+    #elif defined CIS_LINUX
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+    #endif
+
+    return 1;
+}
+
 void
 CInsim::SendMTC (byte UCID, std::string Msg, byte Sound)
 {
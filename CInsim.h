@@ -76,10 +76,16 @@ typedef struct
 #include <string>
 #include <cstdarg>
 #include <stdexcept>
+#include <atomic>
+#include <random>
+#include <functional>
+#include <vector>
+#include <chrono>
 
 // Includes for Windows (uses winsock2)
 #ifdef CIS_WINDOWS
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <mutex>
 
 // Includes for *NIX (no winsock2, these headers are needed instead)
@@ -90,16 +96,31 @@ typedef struct
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <fstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+
+#define INVALID_SOCKET -1
 #endif
 
 #define PACKET_BUFFER_SIZE 1020
 #define PACKET_MAX_SIZE 1020
 #define IS_TIMEOUT 5
 
-#define IS_USE_STATIC
+#define IS_RESYNC_REQI 255              // ReqI used by resync() for its requests. Keep it free in your app
+#define IS_RECONNECT_MIN 500            // Default backoff range for automatic reconnection (ms)
+#define IS_RECONNECT_MAX 30000
+
+/* IS_USE_STATIC enables the legacy getInstance()/removeInstance() singleton
+ * accessors. It is no longer defined by default: any number of CInsim objects
+ * can live in the same process, each one owning its own sockets, buffers and
+ * send mutex. Define it when building the library to keep old apps working.
+ */
+//#define IS_USE_STATIC
 
 #define IS_DEBUG
 
@@ -119,6 +140,20 @@ struct packBuffer
 	unsigned int bytes;                 // Number of bytes currently in buffer
 };
 
+// Throughput counters of a connection (TCP and UDP together)
+struct insimStats
+{
+    unsigned long long packetsIn;       // Packets received, keep alives included
+    unsigned long long bytesIn;         // Bytes received
+    unsigned long long packetsOut;      // Packets sent
+    unsigned long long bytesOut;        // Bytes sent
+};
+
+class CInsimShm;
+class CInsimRegistry;
+class CInsimCars;
+class CInsimFrames;
+
 /**
 * CInsim class to manage the Insim connection and processing of the packets
 */
@@ -126,26 +161,23 @@ class CInsim
 {
   private:
     std::string hostname;
-    word tcpPort;
-    word udpPort;
+    word tcpPort = 0;
+    word udpPort = 0;
     std::string product;
     std::string password;
-    byte prefix;
-    word flags;
-    word interval;
-    byte version;
+    byte prefix = 0;
+    word flags = 0;
+    word interval = 0;
+    byte version = 8;
 
     bool sendPackVer = true;
     std::string hostVersion;
     std::string hostProduct;
-    byte   hostInSimVersion;
+    byte   hostInSimVersion = 0;
 
 
 
     #ifdef IS_USE_STATIC
-    CInsim();
-    CInsim(const std::string hostname, const word port, const std::string product, const std::string admin, byte prefix = 0, word flags = 0, word interval = 0, word udpport = 0, byte version = 8);
-    ~CInsim();
     static CInsim* self;
     #endif // IS_USE_STATIC
 
@@ -156,9 +188,10 @@ class CInsim
     int sock;                               // TCP Socket (most packets)
     int sockudp;                            // UDP Socket (if requested, for NLP and MCI)
     #endif
-    byte using_udp;                         // 1 if we are using UDP for NLP or MCI packets
-    struct packBuffer gbuf;                     // Our global buffer
+    byte using_udp = 0;                     // 1 if we are using UDP for NLP or MCI packets
+    bool connected = false;                 // true between a successful init() and disconnect()
     struct packBuffer lbuf;                     // Our local buffer
+    unsigned int cur_size;                      // Size of the packet at the start of lbuf that has already been handed out
     char packet[PACKET_MAX_SIZE];           // A buffer where the current packet is stored
     fd_set readfd, exceptfd;                // File descriptor watches
     #ifdef CIS_WINDOWS
@@ -170,20 +203,76 @@ class CInsim
     struct packBuffer udp_lbuf;                 // (for NLP and MCI packets via UDP) Our local buffer (no global buffer needed for UDP)
     char udp_packet[PACKET_MAX_SIZE];       // (for NLP and MCI packets via UDP) A buffer where the current packet is stored
     fd_set udp_readfd, udp_exceptfd;        // (for NLP and MCI packets via UDP) File descriptor watches
-    std::mutex *ismutex;                // Mutex var used for send_packet() method
+    std::mutex *ismutex = nullptr;      // Mutex var used for send_packet() method (nullptr once moved from)
+
+    std::atomic<unsigned long long> packets_in{0};      // Throughput counters, see getStats()
+    std::atomic<unsigned long long> bytes_in{0};
+    std::atomic<unsigned long long> packets_out{0};
+    std::atomic<unsigned long long> bytes_out{0};
+
+    bool auto_reconnect = false;                // Reconnect from next_packet() when the connection is lost
+    unsigned reconnect_min = IS_RECONNECT_MIN;  // Backoff range (ms)
+    unsigned reconnect_max = IS_RECONNECT_MAX;
+    unsigned reconnect_attempts = 0;            // Failed attempts since the connection was lost
+    std::minstd_rand jitter;                    // Per instance generator for the backoff jitter
+    bool handshaking = false;                   // init() is waiting for IS_VER: don't reconnect from next_packet()
+    bool state_ready = false;                   // All the replies to the last resync() have arrived
+    std::function<void (CInsim*)> on_state_ready;
+
+    int send_bytes(const char* data, size_t len);  // Sends raw data. ismutex must be locked
+    int prepare_packet(void* packet);           // Sets the size of variable sized packets
+    int wait_reconnect();                       // Blocks until reconnect() succeeds
+
+    bool fast_start = false;                    // Non-blocking connect, no wait for IS_VER, single first flush
+    unsigned connect_timeout = IS_TIMEOUT * 1000;   // Maximum time to establish the TCP connection (ms)
+    std::vector<std::string> startup_requests;  // (fast start) Packets sent along with the IS_ISI
+    bool resync_pending = false;                // (fast start) Append the resync() burst to the first flush
+    bool host_resolved = false;                 // host_addr holds the resolved hostname
+    struct in_addr host_addr;                   // Cached address of the host
+    bool connecting = false;                    // reconnectStart() is waiting for the TCP connection
+    bool awaiting_ver = false;                  // A pipelined IS_ISI asked for IS_VER, which hasn't arrived yet
+    std::chrono::steady_clock::time_point connect_deadline;    // End of the connection or IS_VER wait
+
+    int open_tcp(struct sockaddr_in* saddr);    // Creates the TCP socket and fills the host address
+    int open_udp();
+    int start_connect(struct sockaddr_in* saddr);   // Non-blocking connect(): 1 connected, 0 in progress, -1 error
+    int connect_wait(int timeout_ms);           // Waits for start_connect(): 1 connected, 0 not yet, -1 error
+    int connect_socket(struct sockaddr_in* saddr);
+    void abort_connect();
+    int handshake(bool pipelined);              // Sends the IS_ISI, then waits for IS_VER unless pipelined
+    #ifdef CIS_LINUX
+    int init_local(bool pipelined);             // init() for a UNIX socket path (see CInsimMux)
+    #endif
+    int send_first_flush(struct IS_ISI* isi_p);
+    unsigned resync_burst(std::string& out);
+
+    #ifdef CIS_LINUX
+    CInsimShm* shm = nullptr;                   // Shared memory publisher, see publishState()
+    #endif
+    CInsimRegistry* registry = nullptr;         // Connections and players of the host (nullptr once moved from)
+    CInsimCars* cars = nullptr;                 // Car positions, one array per field (nullptr once moved from)
+    CInsimFrames* frames = nullptr;             // Complete MCI frames (nullptr once moved from)
+    void track(void* packet);                   // Updates the built-in state from every received packet
 
   public:
     #ifdef IS_USE_STATIC
     static CInsim* getInstance();
     static CInsim* getInstance(const std::string hostname, const word port, const std::string product, const std::string admin, byte prefix = 0, word flags = 0, word interval = 0, word udpport = 0, byte version = 9);
     static void removeInstance();
-    #else
+    #endif // IS_USE_STATIC
+
     CInsim();
     CInsim(const std::string hostname, const word port, const std::string product, const std::string admin, byte prefix = 0, word flags = 0, word interval = 0, word udpport = 0, byte version = 8);
     ~CInsim();
-    #endif // IS_USE_STATIC
+
+    // Instances own their sockets and send mutex: they can be moved (e.g. into a container) but not copied
+    CInsim(const CInsim&) = delete;
+    CInsim& operator=(const CInsim&) = delete;
+    CInsim(CInsim&& other);
+    CInsim& operator=(CInsim&& other);
+    void swap(CInsim& other);
 
-    CInsim* setHost(const std::string hostname);
+    CInsim* setHost(const std::string hostname);                // On *NIX, an absolute path connects to a CInsimMux UNIX socket
     CInsim* setTCPPort(const word port);
     CInsim* setUDPPort(const word port);
     CInsim* setProduct(const std::string name);
@@ -194,14 +283,97 @@ class CInsim
     CInsim* setVersion(const byte version);
 
     byte    getHostVersion();
+    std::string getHostLFSVersion() { return hostVersion; }     // e.g. "0.7E", from the last IS_VER
+    std::string getHostProduct() { return hostProduct; }        // e.g. "S3", from the last IS_VER
+    byte    getVersion() { return version; }                    // InSim version requested in the IS_ISI
+    struct insimStats getStats();       // Throughput counters, can be read from any thread
+
+    #ifdef CIS_WINDOWS
+    SOCKET  getSocket() { return sock; }                            // TCP socket, to watch it from an external event loop
+    SOCKET  getUDPSocket() { return using_udp ? sockudp : INVALID_SOCKET; }
+    #elif defined CIS_LINUX
+    int     getSocket() { return sock; }                            // TCP socket, to watch it from an external event loop
+    int     getUDPSocket() { return using_udp ? sockudp : INVALID_SOCKET; }
+    #endif
+    bool    isConnected() { return connected; }
 
     int init();                         // Establishes connection with the socket and insim.
     int disconnect();                   // Closes connection from insim and from the socket
+
+    /** @brief Reconnect automatically when the connection is lost
+     *
+     * next_packet() then retries with jittered exponential backoff instead of returning
+     * -1/-2, and runs resync() after each successful reconnection.
+     * External event loops should call reconnectDelay() and reconnect() themselves.
+     *
+     * @param bool Enable or disable
+     * @param unsigned First (shortest) delay between attempts in ms
+     * @param unsigned Longest delay between attempts in ms
+     * @return CInsim*
+     *
+     */
+    CInsim* setReconnect(bool enable, unsigned minDelay = IS_RECONNECT_MIN, unsigned maxDelay = IS_RECONNECT_MAX);
+    CInsim* setStateReadyCallback(std::function<void (CInsim*)> func);  // Called when the resync() replies are complete
+    unsigned reconnectDelay();          // Delay (ms) to wait before the next reconnect() attempt
+    int reconnect();                    // A single attempt: closes what is left, init() and resync()
+
+    /** @brief Reconnect without blocking, for external event loops (see CInsimManager)
+     *
+     * Starts connecting and returns at once. While isConnecting(), watch getSocket() for
+     * writability and call reconnectStep(). Once connected, the IS_ISI leaves together with
+     * the resync() burst and IS_VER is handled by poll_packet() when it arrives. A connection
+     * or IS_VER that doesn't come within the connection timeout is given up.
+     *
+     * @return int 1 if connected, 0 if in progress, -1 on failure (try again after reconnectDelay())
+     *
+     */
+    int reconnectStart();
+    int reconnectStep();                // Goes on with reconnectStart(): 1 done, 0 in progress, -1 failed (and closed)
+    int connectWait();                  // Time (ms) before the connection or IS_VER wait in progress gives up, -1 if none
+    bool isConnecting() { return connecting; }
+    int resync();                       // Requests connections, players, race, state, layout and cars in one burst
+    bool isStateReady() { return state_ready; }
+    CInsimRegistry* getRegistry() { return registry; }     // Connections and players tracked from the packets received, see CInsimRegistry.h
+    CInsimCars* getCars() { return cars; }                  // Last IS_MCI/IS_NLP data of every car, see CInsimCars.h
+    CInsimFrames* getFrames() { return frames; }            // Complete MCI frames for another thread, see CInsimFrames.h
+
+    #ifdef CIS_LINUX
+    /** @brief Publish the car and connection tables in POSIX shared memory
+     *
+     * Every IS_MCI, IS_NLP and connection packet received afterwards is copied into the
+     * segment, where other processes read it with CInsimShmReader (see CInsimShm.h).
+     *
+     * @param std::string Segment name, e.g. "/insim_state". Empty to stop publishing
+     * @return int 0 on success, -1 if the segment can't be created
+     *
+     */
+    int publishState(const std::string name);
+    #endif
+
+    /** @brief Cold start in about one round trip
+     *
+     * init() then connects without blocking (giving up after connectTimeout ms), sends the
+     * IS_ISI and every startup request in a single send() and returns without waiting for
+     * IS_VER, which is handled by poll_packet()/next_packet() when it arrives.
+     *
+     * @param bool Enable or disable
+     * @param unsigned Connection timeout in ms
+     * @return CInsim*
+     *
+     */
+    CInsim* setFastStart(bool enable, unsigned connectTimeout = IS_TIMEOUT * 1000);
+    int addStartupRequest(void* packet);    // (fast start) Packet to send with the IS_ISI on every init()
+    void clearStartupRequests();
+    bool getReconnect() { return auto_reconnect; }
     int next_packet();                  // Gets next packet ready into "char packet[]"
+    int recv_data();                    // Reads once from the TCP socket without waiting for a full packet (for external event loops)
+    int poll_packet();                  // Gets next packet ready from the data already read. 1 = ready, 0 = need more data
     char peek_packet();                 // Returns the type of the current packet
     void* get_packet();                 // Returns a pointer to the current packet. Must be casted
     int send_packet(void* packet);      // Sends a packet to the host
+    int send_raw(const void* data, size_t len);    // Sends packets already encoded for the InSim version in use
     int udp_next_packet();              // (UDP) Gets next packet ready into "char udp_packet[]"
+    int udp_recv_packet();              // (UDP) Reads one datagram into "char udp_packet[]" (for external event loops)
     char udp_peek_packet();             // (UDP) Returns the type of the current packet
     void* udp_get_packet();             // (UDP) Returns a pointer to the current packet. Must be casted
 
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimBests
+ * ===========
+ *
+ * Incremental best laps and sectors. See CInsimBests.h
+ */
+
+#include <CInsimBests.h>
+
+CInsimBests::CInsimBests()
+{
+    clear();
+}
+
+void CInsimBests::clear()
+{
+    memset(active, 0, sizeof(active));
+    memset(what, 0, sizeof(what));
+    changed.reset();
+    numSplits = 3;
+    reset();
+}
+
+void CInsimBests::reset()
+{
+    memset(players, 0, sizeof(players));
+    memset(splitTime, 0, sizeof(splitTime));
+    memset(&session, 0, sizeof(session));
+
+    // Every player's buttons show blank times again
+    for (int i = 1; i < 256; i++)
+    {
+        if (active[i])
+            mark(i, BEST_ALL);
+    }
+}
+
+void CInsimBests::reset_player(byte PLID)
+{
+    memset(&players[PLID], 0, sizeof(struct playerBests));
+    memset(splitTime[PLID], 0, sizeof(splitTime[PLID]));
+    what[PLID] = 0;
+    changed.reset(PLID);
+}
+
+void CInsimBests::mark(byte PLID, word bits)
+{
+    what[PLID] |= bits;
+    changed.set(PLID);
+}
+
+const struct playerBests* CInsimBests::getPlayer(byte PLID)
+{
+    return active[PLID] ? &players[PLID] : nullptr;
+}
+
+// Sum of the sectors of a lap, 0 if one is missing
+static unsigned sum_sectors(const unsigned* sectors, int count)
+{
+    unsigned sum = 0;
+
+    for (int k = 0; k < count; k++)
+    {
+        if (!sectors[k])
+            return 0;
+        sum += sectors[k];
+    }
+
+    return sum;
+}
+
+void CInsimBests::sector(byte PLID, int k, unsigned time)
+{
+    struct playerBests* p = &players[PLID];
+    word bits = BEST_LAST;
+
+    p->lastSectors[k] = time;
+    p->sectorMarks[k] = MARK_NONE;
+
+    if (!p->sectors[k] || time < p->sectors[k])
+    {
+        p->sectors[k] = time;
+        p->sectorMarks[k] = MARK_PERSONAL;
+        bits |= BEST_SECTOR1 << k;
+
+        unsigned theoretical = sum_sectors(p->sectors, numSplits + 1);
+        if (theoretical != p->theoretical)
+        {
+            p->theoretical = theoretical;
+            bits |= BEST_THEORETICAL;
+        }
+
+        if (!session.sectors[k] || time < session.sectors[k])
+        {
+            // The previous holder's time turns green
+            byte old = session.sectorPLID[k];
+            if (old && old != PLID && players[old].sectorMarks[k] == MARK_SESSION)
+            {
+                players[old].sectorMarks[k] = MARK_PERSONAL;
+                mark(old, BEST_LAST);
+            }
+
+            session.sectors[k] = time;
+            session.sectorPLID[k] = PLID;
+            session.theoretical = sum_sectors(session.sectors, numSplits + 1);
+            p->sectorMarks[k] = MARK_SESSION;
+        }
+    }
+
+    mark(PLID, bits);
+}
+
+void CInsimBests::lap(byte PLID, unsigned time)
+{
+    struct playerBests* p = &players[PLID];
+    word bits = BEST_LAST;
+
+    p->lastLap = time;
+    p->lapMark = MARK_NONE;
+
+    if (!p->lap || time < p->lap)
+    {
+        p->lap = time;
+        p->lapMark = MARK_PERSONAL;
+        bits |= BEST_LAP;
+
+        if (!session.lap || time < session.lap)
+        {
+            byte old = session.lapPLID;
+            if (old && old != PLID && players[old].lapMark == MARK_SESSION)
+            {
+                players[old].lapMark = MARK_PERSONAL;
+                mark(old, BEST_LAST);
+            }
+
+            session.lap = time;
+            session.lapPLID = PLID;
+            p->lapMark = MARK_SESSION;
+        }
+    }
+
+    mark(PLID, bits);
+}
+
+void CInsimBests::update(void* packet)
+{
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_RST:
+        {
+            struct IS_RST* rst = (struct IS_RST*)packet;
+            // Checkpoints of the lap timing in use, none if there is no lap timing
+            numSplits = (rst->Timing & 0xc0) != 0xc0 ? rst->Timing & 0x03 : 0;
+
+            // A reply to TINY_RST describes the session already going on
+            if (rst->ReqI == 0)
+                reset();
+            break;
+        }
+
+        case ISP_NPL:
+        {
+            struct IS_NPL* npl = (struct IS_NPL*)packet;
+
+            if (npl->NumP != 0 && !active[npl->PLID])
+            {
+                reset_player(npl->PLID);
+                active[npl->PLID] = true;
+            }
+            break;
+        }
+
+        case ISP_PLL:
+        {
+            byte p = ((struct IS_PLL*)packet)->PLID;
+
+            active[p] = false;
+            what[p] = 0;
+            changed.reset(p);
+
+            // The session bests stay, without a holder
+            if (session.lapPLID == p)
+                session.lapPLID = 0;
+
+            for (int k = 0; k < IS_BESTS_SECTORS; k++)
+            {
+                if (session.sectorPLID[k] == p)
+                    session.sectorPLID[k] = 0;
+            }
+            break;
+        }
+
+        case ISP_SPX:
+        {
+            struct IS_SPX* spx = (struct IS_SPX*)packet;
+            unsigned* split = splitTime[spx->PLID];
+            int s = spx->Split;
+
+            if (!active[spx->PLID] || s < 1 || s > 3)
+                break;
+
+            // Split 1 is timed from the start of the lap, the others from the previous split
+            if (s == 1)
+                sector(spx->PLID, 0, spx->STime);
+            else if (split[s - 2] && spx->STime > split[s - 2])
+                sector(spx->PLID, s - 1, spx->STime - split[s - 2]);
+
+            split[s - 1] = spx->STime;
+            break;
+        }
+
+        case ISP_LAP:
+        {
+            struct IS_LAP* l = (struct IS_LAP*)packet;
+            unsigned* split = splitTime[l->PLID];
+
+            if (!active[l->PLID] || l->LTime == 0)
+                break;
+
+            if (numSplits == 0)
+                sector(l->PLID, 0, l->LTime);
+            else if (split[numSplits - 1] && l->LTime > split[numSplits - 1])
+                sector(l->PLID, numSplits, l->LTime - split[numSplits - 1]);
+
+            lap(l->PLID, l->LTime);
+            memset(split, 0, sizeof(splitTime[0]));
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            break;
+    }
+}
+
+int CInsimBests::takeChanges(byte* plids, word* bits)
+{
+    int n = 0;
+
+    for (int i = 1; i < 256; i++)
+    {
+        if (!changed[i])
+            continue;
+
+        plids[n] = i;
+        if (bits)
+            bits[n] = what[i];
+        what[i] = 0;
+        n++;
+    }
+
+    changed.reset();
+    return n;
+}
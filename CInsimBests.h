@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimBests
+ * ===========
+ *
+ * Personal, session and theoretical bests kept up to date from IS_SPX and
+ * IS_LAP, for colouring timing towers without going through the history
+ * again. Each timing packet compares the new lap or sector time with the
+ * best of its player and the best of the session, so it costs the same
+ * whatever the number of laps done.
+ *
+ * Sector k is the time from split k-1 to split k, as placed by IS_RST
+ * Split1..3, and the last sector ends at the finish line (as in CInsimLaps).
+ * The theoretical best of a player is the sum of their best sectors; the
+ * one of the session, the sum of the best sectors of anybody.
+ *
+ * Every change is recorded per player with BEST_ bits, including the player
+ * whose time stops being the session best, and takeChanges() hands them
+ * over so only the affected buttons are sent again.
+ */
+
+#ifndef _CINSIMBESTS_H
+#define _CINSIMBESTS_H
+
+#include "CInsim.h"
+
+#include <bitset>
+
+#define IS_BESTS_SECTORS 4              // Up to 3 splits
+
+// Colour of a time
+enum
+{
+    MARK_NONE,                          // Slower than the personal best
+    MARK_PERSONAL,                      // Personal best (green)
+    MARK_SESSION,                       // Session best (purple)
+};
+
+// What changed for a player
+enum
+{
+    BEST_LAP = 1,                       // Personal best lap
+    BEST_SECTOR1 = 2,                   // Personal best sector 1, BEST_SECTOR1 << 1 for sector 2 and so on
+    BEST_THEORETICAL = 32,              // Theoretical best
+    BEST_LAST = 64,                     // Last lap or sector time, or its mark
+    BEST_ALL = 127,
+};
+
+// Best times of a player. Times in ms, 0 if none
+struct playerBests
+{
+    unsigned    lap;
+    unsigned    sectors[IS_BESTS_SECTORS];
+    unsigned    theoretical;            // Sum of the best sectors, 0 until every sector has a time
+
+    unsigned    lastLap;
+    unsigned    lastSectors[IS_BESTS_SECTORS];  // In the current lap, or the last one for the sectors not crossed yet
+    byte        lapMark;                // MARK_ of lastLap
+    byte        sectorMarks[IS_BESTS_SECTORS];
+};
+
+// Best times of the session
+struct sessionBests
+{
+    unsigned    lap;
+    byte        lapPLID;                // Holder, 0 if they left
+    unsigned    sectors[IS_BESTS_SECTORS];
+    byte        sectorPLID[IS_BESTS_SECTORS];
+    unsigned    theoretical;            // Sum of the best sectors of anybody
+};
+
+/**
+* CInsimBests class to keep the best laps and sectors of a session
+*/
+class CInsimBests
+{
+  private:
+    struct playerBests players[256];    // Indexed by PLID
+    bool active[256];
+    unsigned splitTime[256][3];         // Splits of the current lap, 0 if not crossed
+    word what[256];                     // BEST_ bits changed since takeChanges()
+    std::bitset<256> changed;
+
+    struct sessionBests session;
+    int numSplits;
+
+    void sector(byte PLID, int k, unsigned time);
+    void lap(byte PLID, unsigned time);
+    void mark(byte PLID, word bits);
+    void reset_player(byte PLID);
+
+  public:
+    CInsimBests();
+
+    void clear();                       // Forgets the players and the session bests
+    void reset();                       // New session: forgets the times, keeps the players
+    void update(void* packet);          // Applies an IS_RST, IS_NPL, IS_PLL, IS_SPX, IS_LAP or TINY_CLR/MPE. Other types are ignored
+
+    const struct playerBests* getPlayer(byte PLID);     // nullptr if not in the session
+    const struct sessionBests* getSession() { return &session; }
+
+    /** @brief Players changed since the last call
+     *
+     * @param byte* PLIDs. Room for 255 entries
+     * @param word* BEST_ bits of each, in the same order (can be NULL)
+     * @return int Number of players written
+     *
+     */
+    int takeChanges(byte* plids, word* bits = NULL);
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimCars
+ * ==========
+ *
+ * Car state store in structure of arrays layout. See CInsimCars.h
+ */
+
+#include <CInsimCars.h>
+
+CInsimCars::CInsimCars()
+{
+    memset(X, 0, sizeof(X));
+    memset(Y, 0, sizeof(Y));
+    memset(Z, 0, sizeof(Z));
+    memset(Speed, 0, sizeof(Speed));
+    memset(Direction, 0, sizeof(Direction));
+    memset(Heading, 0, sizeof(Heading));
+    memset(AngVel, 0, sizeof(AngVel));
+    memset(Node, 0, sizeof(Node));
+    memset(Lap, 0, sizeof(Lap));
+    memset(Position, 0, sizeof(Position));
+    memset(Info, 0, sizeof(Info));
+    clear();
+}
+
+void CInsimCars::clear()
+{
+    memset(active, 0, sizeof(active));
+    count = 0;
+    updates = 0;
+}
+
+void CInsimCars::add(byte PLID)
+{
+    active[PLID] = 1;
+    slot[PLID] = count;
+    plids[count++] = PLID;
+}
+
+void CInsimCars::remove(byte PLID)
+{
+    if (!active[PLID])
+        return;
+
+    // Keep plids[] dense: the last car takes the freed place
+    byte last = plids[--count];
+    plids[slot[PLID]] = last;
+    slot[last] = slot[PLID];
+    active[PLID] = 0;
+}
+
+void CInsimCars::update(void* packet)
+{
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_MCI:
+        {
+            struct IS_MCI* mci = (struct IS_MCI*)packet;
+            int numc = mci->NumC > MCI_MAX_CARS ? MCI_MAX_CARS : mci->NumC;
+
+            for (int i = 0; i < numc; i++)
+            {
+                const CompCar* info = &mci->Info[i];
+                byte p = info->PLID;
+
+                if (!active[p])
+                    add(p);
+
+                X[p] = info->X;
+                Y[p] = info->Y;
+                Z[p] = info->Z;
+                Speed[p] = info->Speed;
+                Direction[p] = info->Direction;
+                Heading[p] = info->Heading;
+                AngVel[p] = info->AngVel;
+                Node[p] = info->Node;
+                Lap[p] = info->Lap;
+                Position[p] = info->Position;
+                Info[p] = info->Info;
+            }
+
+            updates++;
+            break;
+        }
+
+        case ISP_NLP:
+        {
+            struct IS_NLP* nlp = (struct IS_NLP*)packet;
+            int nump = nlp->NumP > NLP_MAX_CARS ? NLP_MAX_CARS : nlp->NumP;
+
+            for (int i = 0; i < nump; i++)
+            {
+                const NodeLap* info = &nlp->Info[i];
+                byte p = info->PLID;
+
+                if (!active[p])
+                    add(p);
+
+                Node[p] = info->Node;
+                Lap[p] = info->Lap;
+                Position[p] = info->Position;
+            }
+
+            updates++;
+            break;
+        }
+
+        case ISP_PLL:
+            remove(((struct IS_PLL*)packet)->PLID);
+            break;
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            break;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimCars
+ * ==========
+ *
+ * Car state store in structure of arrays layout. Each CInsim scatters the
+ * CompCar records of every IS_MCI (and the NodeLap records of IS_NLP) into one
+ * array per field, indexed by PLID (see CInsim::getCars()). Loops over a single
+ * field of every car then read contiguous memory and can be vectorised by the
+ * compiler, instead of striding over 28 byte records.
+ *
+ * The PLIDs holding a car are also kept in a dense list (plids[0..count-1]) so
+ * sweeps don't have to visit the 256 slots.
+ */
+
+#ifndef _CINSIMCARS_H
+#define _CINSIMCARS_H
+
+#include "CInsim.h"
+
+#define IS_CARS_ALIGN 16                // Arrays start on a 16 byte boundary (SSE loads, the most new guarantees before C++17)
+
+/**
+* CInsimCars class with the last known state of every car, one array per field
+*/
+class CInsimCars
+{
+  public:
+    // Read only for applications, indexed by PLID. Slots without a car hold stale data
+    alignas(IS_CARS_ALIGN) int X[256];          // X map (65536 = 1 metre)
+    alignas(IS_CARS_ALIGN) int Y[256];          // Y map (65536 = 1 metre)
+    alignas(IS_CARS_ALIGN) int Z[256];          // Z alt (65536 = 1 metre)
+    alignas(IS_CARS_ALIGN) word Speed[256];     // speed (32768 = 100 m/s)
+    alignas(IS_CARS_ALIGN) word Direction[256]; // car's motion if Speed > 0: 0 = world y direction, 32768 = 180 deg
+    alignas(IS_CARS_ALIGN) word Heading[256];   // direction of forward axis: 0 = world y direction, 32768 = 180 deg
+    alignas(IS_CARS_ALIGN) short AngVel[256];   // signed, rate of change of heading: (16384 = 360 deg/s)
+    alignas(IS_CARS_ALIGN) word Node[256];      // current path node
+    alignas(IS_CARS_ALIGN) word Lap[256];       // current lap
+    alignas(IS_CARS_ALIGN) byte Position[256];  // current race position: 0 = unknown, 1 = leader, etc...
+    alignas(IS_CARS_ALIGN) byte Info[256];      // CCI_ flags of the last IS_MCI
+    alignas(IS_CARS_ALIGN) byte active[256];    // 1 if the slot holds a car
+
+    byte plids[256];                            // PLIDs holding a car, plids[0..count-1]
+    int count;
+    unsigned updates;                           // Number of IS_MCI/IS_NLP applied
+
+  private:
+    byte slot[256];                             // Index of each active PLID in plids[]
+
+    void add(byte PLID);
+
+  public:
+    CInsimCars();
+
+    void clear();
+    void remove(byte PLID);
+    void update(void* packet);          // Applies IS_MCI, IS_NLP, IS_PLL and TINY_CLR/TINY_MPE. Other types are ignored
+};
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimControl
+ * =============
+ *
+ * Race control state of every car. See CInsimControl.h
+ */
+
+#include <CInsimControl.h>
+
+CInsimControl::CInsimControl()
+{
+    clear();
+}
+
+void CInsimControl::clear()
+{
+    memset(cars, 0, sizeof(cars));
+    memset(active, 0, sizeof(active));
+}
+
+void CInsimControl::setControlCallback(controlFunc func)
+{
+    on_change = func;
+}
+
+void CInsimControl::set(byte PLID, unsigned bits, bool on)
+{
+    if (on)
+        cars[PLID].state |= bits;
+    else
+        cars[PLID].state &= ~bits;
+}
+
+void CInsimControl::changed(byte PLID, unsigned before)
+{
+    if (on_change)
+        on_change(&cars[PLID], before ^ cars[PLID].state);
+}
+
+void CInsimControl::update(void* packet)
+{
+    byte type = *((byte*)packet + 1);
+
+    switch (type)
+    {
+        case ISP_RST:
+        {
+            // A reply to TINY_RST describes the race already going on
+            if (((struct IS_RST*)packet)->ReqI != 0)
+                break;
+
+            for (int i = 1; i < 256; i++)
+            {
+                if (!active[i])
+                    continue;
+
+                unsigned before = cars[i].state;
+
+                cars[i].state &= CTRL_INPITS;
+                cars[i].penalty = PENALTY_NONE;
+                cars[i].reason = PENR_UNKNOWN;
+                cars[i].penalties = 0;
+                cars[i].blueFor = 0;
+                memset(cars[i].hlv, 0, sizeof(cars[i].hlv));
+
+                if (before != cars[i].state)
+                    changed(i, before);
+            }
+            break;
+        }
+
+        case ISP_NPL:
+        {
+            struct IS_NPL* npl = (struct IS_NPL*)packet;
+            struct controlState* car = &cars[npl->PLID];
+
+            if (npl->NumP == 0)
+                break;
+
+            // Joining again after a pit: the penalties and counters of the race stay
+            if (!active[npl->PLID])
+            {
+                memset(car, 0, sizeof(struct controlState));
+                car->PLID = npl->PLID;
+                active[npl->PLID] = true;
+            }
+
+            unsigned before = car->state;
+            car->flags = npl->Flags;
+            set(npl->PLID, CTRL_INPITS, (npl->Flags & PIF_INPITS) != 0);
+            set(npl->PLID, CTRL_STOPPED | CTRL_BLUE | CTRL_YELLOW, false);
+            changed(npl->PLID, before);
+            break;
+        }
+
+        case ISP_PLL:
+            active[((struct IS_PLL*)packet)->PLID] = false;
+            break;
+
+        case ISP_PEN:
+        case ISP_FLG:
+        case ISP_PFL:
+        case ISP_CSC:
+        case ISP_HLV:
+        {
+            byte p = *((byte*)packet + 3);
+            struct controlState* car = &cars[p];
+
+            if (!active[p])
+                break;
+
+            unsigned before = car->state;
+
+            if (type == ISP_PEN)
+            {
+                struct IS_PEN* pen = (struct IS_PEN*)packet;
+
+                // Newly given, not a change of the current one
+                if (pen->NewPen != PENALTY_NONE && pen->OldPen == PENALTY_NONE)
+                    car->penalties++;
+
+                car->penalty = pen->NewPen;
+                car->reason = pen->Reason;
+                set(p, CTRL_PENALTY, pen->NewPen != PENALTY_NONE);
+                set(p, CTRL_SERVABLE, pen->NewPen == PENALTY_DT_VALID || pen->NewPen == PENALTY_SG_VALID);
+            }
+            else if (type == ISP_FLG)
+            {
+                struct IS_FLG* flg = (struct IS_FLG*)packet;
+
+                if (flg->Flag == 1)
+                {
+                    set(p, CTRL_BLUE, flg->OffOn != 0);
+                    car->blueFor = flg->OffOn ? flg->CarBehind : 0;
+                }
+                else if (flg->Flag == 2)
+                    set(p, CTRL_YELLOW, flg->OffOn != 0);
+            }
+            else if (type == ISP_PFL)
+            {
+                car->flags = ((struct IS_PFL*)packet)->Flags;
+                set(p, CTRL_INPITS, (car->flags & PIF_INPITS) != 0);
+            }
+            else if (type == ISP_CSC)
+            {
+                struct IS_CSC* csc = (struct IS_CSC*)packet;
+
+                if (csc->CSCAction == CSC_STOP)
+                {
+                    set(p, CTRL_STOPPED, true);
+                    car->stopTime = csc->Time;
+                }
+                else if (csc->CSCAction == CSC_START)
+                    set(p, CTRL_STOPPED, false);
+            }
+            else
+            {
+                // HLVC 0: ground / 1: wall / 4: speeding / 5: out of bounds
+                switch (((struct IS_HLV*)packet)->HLVC)
+                {
+                    case 0: car->hlv[HLV_GROUND]++; break;
+                    case 1: car->hlv[HLV_WALL]++; break;
+                    case 4: car->hlv[HLV_SPEEDING]++; break;
+                    case 5: car->hlv[HLV_BOUNDS]++; break;
+                }
+            }
+
+            changed(p, before);
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            break;
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimControl
+ * =============
+ *
+ * Race control state of every car, kept up to date from IS_PEN, IS_FLG,
+ * IS_PFL, IS_CSC and IS_HLV (with IS_NPL, IS_PLL and IS_RST). The flags
+ * that stewarding decisions depend on are packed in one CTRL_ mask per PLID,
+ * so checks like "does this car have a penalty to clear" or "is it stopped
+ * on track" are a single lookup instead of a search through past events.
+ *
+ * The counters (penalties given, HLV incidents) are per race: an IS_RST that
+ * isn't a reply to TINY_RST resets them.
+ */
+
+#ifndef _CINSIMCONTROL_H
+#define _CINSIMCONTROL_H
+
+#include "CInsim.h"
+
+// State flags of a car
+enum
+{
+    CTRL_PENALTY = 1,                   // Has a penalty (PENALTY_DT to PENALTY_45)
+    CTRL_SERVABLE = 2,                  // Drive-through or stop-go that can be served now (PENALTY_DT_VALID, PENALTY_SG_VALID)
+    CTRL_BLUE = 4,                      // Shown the blue flag
+    CTRL_YELLOW = 8,                    // Causing a yellow flag
+    CTRL_STOPPED = 16,                  // Stopped (IS_CSC), until it starts again
+    CTRL_INPITS = 32,                   // PIF_INPITS player flag
+};
+
+// HLV incident kinds, index of controlState::hlv
+enum
+{
+    HLV_GROUND,
+    HLV_WALL,
+    HLV_SPEEDING,
+    HLV_BOUNDS,
+    HLV_NUM
+};
+
+struct controlState
+{
+    byte        PLID;
+    unsigned    state;                  // CTRL_ flags
+    byte        penalty;                // PENALTY_ value
+    byte        reason;                 // PENR_ reason of the last change
+    byte        penalties;              // Penalties given this race
+    word        flags;                  // PIF_ player flags
+    byte        blueFor;                // PLID of the car held up while CTRL_BLUE is set
+    unsigned    stopTime;               // Hundredths of a second since the start, when CTRL_STOPPED was set
+    word        hlv[HLV_NUM];           // HLV incidents this race
+};
+
+/**
+* CInsimControl class to follow penalties, flags and incidents of every car
+*/
+class CInsimControl
+{
+  public:
+    // Called after the state of a car changed, with the CTRL_ flags that changed (0 if only a counter did)
+    typedef std::function<void (const struct controlState* car, unsigned changed)> controlFunc;
+
+  private:
+    struct controlState cars[256];      // Indexed by PLID
+    bool active[256];
+    controlFunc on_change;
+
+    void set(byte PLID, unsigned bits, bool on);
+    void changed(byte PLID, unsigned before);
+
+  public:
+    CInsimControl();
+
+    void clear();                       // Forgets every car
+    void update(void* packet);          // Applies an IS_RST, IS_NPL, IS_PLL, IS_PEN, IS_FLG, IS_PFL, IS_CSC, IS_HLV or TINY_CLR/MPE. Other types are ignored
+    void setControlCallback(controlFunc func);
+
+    const struct controlState* getPlayer(byte PLID) { return active[PLID] ? &cars[PLID] : nullptr; }
+    unsigned getState(byte PLID) { return active[PLID] ? cars[PLID].state : 0; }
+
+    bool canClear(byte PLID) { return (getState(PLID) & CTRL_PENALTY) != 0; }  // There is a penalty for /p_clear to remove
+    bool isStopped(byte PLID) { return (getState(PLID) & CTRL_STOPPED) != 0; }
+    int violations(byte PLID, int kind) { return active[PLID] && kind >= 0 && kind < HLV_NUM ? cars[PLID].hlv[kind] : 0; }
+};
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimDecode
+ * ============
+ *
+ * Batch conversion of CompCar records to metric floats. See CInsimDecode.h
+ */
+
+#include <CInsimDecode.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IS_DECODE_X86
+#include <immintrin.h>
+#endif
+
+#define IS_PI 3.14159265358979f
+
+static const float POS_TO_M = 1.0f / 65536.0f;         // X, Y, Z: 65536 = 1 metre
+static const float SPEED_TO_MS = 100.0f / 32768.0f;     // Speed: 32768 = 100 m/s
+static const float ANGLE_TO_RAD = IS_PI / 32768.0f;     // Heading, Direction: 32768 = 180 deg
+static const float ANGVEL_TO_RAD = IS_PI / 8192.0f;     // AngVel: 16384 = 360 deg/s
+
+// The vector code reads the fields at these offsets
+static_assert(sizeof(CompCar) == 28, "CompCar must be 28 bytes");
+
+static void decode_scalar(const CompCar* cars, int from, int count, struct carFloats* out)
+{
+    for (int i = from; i < count; i++)
+    {
+        out->X[i] = cars[i].X * POS_TO_M;
+        out->Y[i] = cars[i].Y * POS_TO_M;
+        out->Z[i] = cars[i].Z * POS_TO_M;
+        out->Speed[i] = cars[i].Speed * SPEED_TO_MS;
+        out->Direction[i] = cars[i].Direction * ANGLE_TO_RAD;
+        out->Heading[i] = cars[i].Heading * ANGLE_TO_RAD;
+        out->AngVel[i] = cars[i].AngVel * ANGVEL_TO_RAD;
+    }
+}
+
+#ifdef IS_DECODE_X86
+/**
+* 4 cars per step: the 16 bytes from X to Direction of 4 records form a 4x4 matrix,
+* transposed into X, Y, Z and Speed|Direction vectors
+*/
+__attribute__((target("sse2")))
+static int decode_sse2(const CompCar* cars, int count, struct carFloats* out)
+{
+    const __m128 pos = _mm_set1_ps(POS_TO_M);
+    const __m128 speed = _mm_set1_ps(SPEED_TO_MS);
+    const __m128 angle = _mm_set1_ps(ANGLE_TO_RAD);
+    const __m128 angvel = _mm_set1_ps(ANGVEL_TO_RAD);
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const char* base = (const char*)(cars + i);
+
+        __m128 r0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(base + 8)));
+        __m128 r1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(base + 28 + 8)));
+        __m128 r2 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(base + 56 + 8)));
+        __m128 r3 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(base + 84 + 8)));
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        _mm_storeu_ps(out->X + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(r0)), pos));
+        _mm_storeu_ps(out->Y + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(r1)), pos));
+        _mm_storeu_ps(out->Z + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(r2)), pos));
+
+        __m128i sd = _mm_castps_si128(r3);
+        _mm_storeu_ps(out->Speed + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(sd, low)), speed));
+        _mm_storeu_ps(out->Direction + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(sd, 16)), angle));
+
+        // Heading (unsigned) and AngVel (signed) share the last 4 bytes of each record
+        int h[4];
+        memcpy(&h[0], base + 24, 4);
+        memcpy(&h[1], base + 28 + 24, 4);
+        memcpy(&h[2], base + 56 + 24, 4);
+        memcpy(&h[3], base + 84 + 24, 4);
+        __m128i ha = _mm_loadu_si128((const __m128i*)h);
+
+        _mm_storeu_ps(out->Heading + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(ha, low)), angle));
+        _mm_storeu_ps(out->AngVel + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(ha, 16)), angvel));
+    }
+
+    return i;
+}
+
+/**
+* 8 cars per step: each field is gathered from 8 records at a stride of 7 ints
+*/
+__attribute__((target("avx2")))
+static int decode_avx2(const CompCar* cars, int count, struct carFloats* out)
+{
+    const __m256 pos = _mm256_set1_ps(POS_TO_M);
+    const __m256 speed = _mm256_set1_ps(SPEED_TO_MS);
+    const __m256 angle = _mm256_set1_ps(ANGLE_TO_RAD);
+    const __m256 angvel = _mm256_set1_ps(ANGVEL_TO_RAD);
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    const __m256i stride = _mm256_setr_epi32(0, 7, 14, 21, 28, 35, 42, 49);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        const int* base = (const int*)(cars + i);
+
+        __m256i x = _mm256_i32gather_epi32(base + 2, stride, 4);
+        __m256i y = _mm256_i32gather_epi32(base + 3, stride, 4);
+        __m256i z = _mm256_i32gather_epi32(base + 4, stride, 4);
+        __m256i sd = _mm256_i32gather_epi32(base + 5, stride, 4);
+        __m256i ha = _mm256_i32gather_epi32(base + 6, stride, 4);
+
+        _mm256_storeu_ps(out->X + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), pos));
+        _mm256_storeu_ps(out->Y + i, _mm256_mul_ps(_mm256_cvtepi32_ps(y), pos));
+        _mm256_storeu_ps(out->Z + i, _mm256_mul_ps(_mm256_cvtepi32_ps(z), pos));
+        _mm256_storeu_ps(out->Speed + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(sd, low)), speed));
+        _mm256_storeu_ps(out->Direction + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(sd, 16)), angle));
+        _mm256_storeu_ps(out->Heading + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(ha, low)), angle));
+        _mm256_storeu_ps(out->AngVel + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(ha, 16)), angvel));
+    }
+
+    return i;
+}
+#endif // IS_DECODE_X86
+
+static int detect_level()
+{
+    #ifdef IS_DECODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return DECODE_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return DECODE_SSE2;
+    #endif
+    return DECODE_SCALAR;
+}
+
+static int supported_level = detect_level();
+static int level = supported_level;
+
+int decodeLevel()
+{
+    return level;
+}
+
+void decodeForce(int forced)
+{
+    level = forced < supported_level ? forced : supported_level;
+}
+
+int decodeCars(const CompCar* cars, int count, struct carFloats* out)
+{
+    if (count > IS_FRAME_MAX_CARS)
+        count = IS_FRAME_MAX_CARS;
+
+    int done = 0;
+
+    #ifdef IS_DECODE_X86
+    if (level == DECODE_AVX2)
+        done = decode_avx2(cars, count, out);
+    else if (level == DECODE_SSE2)
+        done = decode_sse2(cars, count, out);
+    #endif
+
+    decode_scalar(cars, done, count, out);
+
+    for (int i = 0; i < count; i++)
+        out->PLID[i] = cars[i].PLID;
+
+    out->count = count;
+    return count;
+}
+
+int decodeFrame(const struct mciFrame* frame, struct carFloats* out)
+{
+    return decodeCars(frame->cars, frame->numCars, out);
+}
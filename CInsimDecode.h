@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimDecode
+ * ============
+ *
+ * Batch conversion of CompCar records to metric floats. A whole MCI frame is
+ * decoded in one pass into one float array per field:
+ *
+ * - X, Y, Z in metres (65536 = 1 m)
+ * - Speed in m/s (32768 = 100 m/s)
+ * - Direction and Heading in radians (32768 = 180 deg)
+ * - AngVel in radians per second (16384 = 360 deg/s)
+ *
+ * With GCC or Clang on x86, AVX2 (8 cars per step) is used when the CPU has
+ * it, SSE2 (4 cars per step) otherwise. Other compilers and CPUs use the
+ * scalar code, which also handles the last cars of a batch.
+ */
+
+#ifndef _CINSIMDECODE_H
+#define _CINSIMDECODE_H
+
+#include "CInsimFrames.h"
+
+enum
+{
+    DECODE_SCALAR,
+    DECODE_SSE2,
+    DECODE_AVX2,
+};
+
+// Decoded cars, in the order of the CompCar records
+struct carFloats
+{
+    int count;
+    byte PLID[IS_FRAME_MAX_CARS];
+    float X[IS_FRAME_MAX_CARS];
+    float Y[IS_FRAME_MAX_CARS];
+    float Z[IS_FRAME_MAX_CARS];
+    float Speed[IS_FRAME_MAX_CARS];
+    float Direction[IS_FRAME_MAX_CARS];
+    float Heading[IS_FRAME_MAX_CARS];
+    float AngVel[IS_FRAME_MAX_CARS];
+};
+
+/** @brief Decode CompCar records
+ *
+ * @param CompCar* Records, e.g. IS_MCI::Info or mciFrame::cars
+ * @param int Number of records (at most IS_FRAME_MAX_CARS)
+ * @param carFloats* Output
+ * @return int Number of cars decoded
+ *
+ */
+int decodeCars(const CompCar* cars, int count, struct carFloats* out);
+int decodeFrame(const struct mciFrame* frame, struct carFloats* out);
+
+int decodeLevel();                      // DECODE_ code path used by decodeCars() on this CPU
+void decodeForce(int level);            // Use a lower code path, e.g. to compare them. Higher ones than the CPU supports are ignored
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimFrames
+ * ============
+ *
+ * Complete MCI frames. See CInsimFrames.h
+ */
+
+#include <CInsimFrames.h>
+
+#define IS_FRAME_NEW 4                  // Flag in "middle": published and not taken by the reader yet
+
+CInsimFrames::CInsimFrames()
+{
+    back = 0;
+    middle = 1;
+    front = 2;
+    assembling = false;
+    seq = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        buffers[i].seq = 0;
+        buffers[i].numCars = 0;
+    }
+}
+
+void CInsimFrames::clear()
+{
+    assembling = false;
+}
+
+void CInsimFrames::setFrameCallback(frameFunc func)
+{
+    on_frame = func;
+}
+
+void CInsimFrames::update(void* packet)
+{
+    if (*((byte*)packet + 1) != ISP_MCI)
+        return;
+
+    struct IS_MCI* mci = (struct IS_MCI*)packet;
+    int numc = mci->NumC > MCI_MAX_CARS ? MCI_MAX_CARS : mci->NumC;
+    struct mciFrame* frame = &buffers[back];
+
+    for (int i = 0; i < numc; i++)
+    {
+        const CompCar* info = &mci->Info[i];
+
+        if (info->Info & CCI_FIRST)
+        {
+            assembling = true;
+            frame->numCars = 0;
+        }
+
+        // Cars of a set whose start we missed are dropped
+        if (!assembling)
+            continue;
+
+        if (frame->numCars < IS_FRAME_MAX_CARS)
+            frame->cars[frame->numCars++] = *info;
+
+        if (info->Info & CCI_LAST)
+        {
+            assembling = false;
+            frame->seq = ++seq;
+            frame->time = std::chrono::steady_clock::now();
+
+            if (on_frame)
+                on_frame(frame);
+
+            // Publish it and take the buffer the reader doesn't hold
+            back = middle.exchange(back | IS_FRAME_NEW, std::memory_order_acq_rel) & 3;
+            frame = &buffers[back];
+        }
+    }
+}
+
+int CInsimFrames::latest(const struct mciFrame** frame)
+{
+    int rc = 0;
+
+    if (middle.load(std::memory_order_relaxed) & IS_FRAME_NEW)
+    {
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        rc = 1;
+    }
+
+    *frame = &buffers[front];
+    return buffers[front].seq == 0 ? -1 : rc;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimFrames
+ * ============
+ *
+ * Complete MCI frames. With more than MCI_MAX_CARS cars in the race, every
+ * update is split into several IS_MCI packets. CInsimFrames collects the cars
+ * of a set, from the one flagged CCI_FIRST to the one flagged CCI_LAST, and
+ * only then publishes the whole frame (see CInsim::getFrames()).
+ *
+ * Publication goes through a triple buffer: the receiving thread fills a back
+ * buffer and swaps it with the middle one, and one reader thread swaps the
+ * middle one with its front buffer in latest(). Neither side ever locks or
+ * waits, and the reader always sees a whole frame.
+ */
+
+#ifndef _CINSIMFRAMES_H
+#define _CINSIMFRAMES_H
+
+#include "CInsim.h"
+
+#include <chrono>
+
+#define IS_FRAME_MAX_CARS 256
+
+// All the cars of one MCI update
+struct mciFrame
+{
+    unsigned seq;                                   // Frame number, increases by one per published frame
+    std::chrono::steady_clock::time_point time;     // When its last packet was received
+    int numCars;
+    CompCar cars[IS_FRAME_MAX_CARS];
+};
+
+/**
+* CInsimFrames class to assemble and publish complete MCI frames
+*/
+class CInsimFrames
+{
+  public:
+    // Called on the receiving thread for each complete frame, before it is published
+    typedef std::function<void (const struct mciFrame* frame)> frameFunc;
+
+  private:
+    struct mciFrame buffers[3];
+    int back;                           // Being assembled, owned by the receiving thread
+    char pad1[64];
+    std::atomic<int> middle;            // Last published, IS_FRAME_NEW set until the reader takes it
+    char pad2[64];
+    int front;                          // Owned by the reader
+
+    bool assembling;                    // CCI_FIRST seen, waiting for CCI_LAST
+    unsigned seq;
+    frameFunc on_frame;
+
+  public:
+    CInsimFrames();
+
+    void clear();                       // Drops a partial frame (e.g. after a reconnection)
+    void update(void* packet);          // Applies an IS_MCI. Other types are ignored
+
+    void setFrameCallback(frameFunc func);
+
+    /** @brief Get the last complete frame (single reader thread)
+     *
+     * @param mciFrame** Set to the frame, which stays valid and unchanged until the next call
+     * @return int 1 if it is newer than on the previous call, 0 if not, -1 if no frame was published yet
+     *
+     */
+    int latest(const struct mciFrame** frame);
+};
+
+#endif
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimGrid
+ * ==========
+ *
+ * Uniform grid over the cars for proximity queries. See CInsimGrid.h
+ */
+
+#include <CInsimGrid.h>
+
+#include <climits>
+
+#define IS_GRID_MAX_RINGS 8             // nearest() scans every car beyond this many rings of cells
+
+CInsimGrid::CInsimGrid(unsigned cellMetres)
+{
+    if (cellMetres == 0) {
+        throw new std::logic_error("CInsimGrid: the cell size must be at least 1 metre");
+    }
+
+    size = (long long)cellMetres * 65536;
+    clear();
+}
+
+void CInsimGrid::clear()
+{
+    memset(inGrid, 0, sizeof(inGrid));
+    memset(lastSeq, 0, sizeof(lastSeq));
+    memset(head, 0, sizeof(head));
+    count = 0;
+}
+
+// Cell of a coordinate, rounding towards minus infinity
+int CInsimGrid::cell(int coord)
+{
+    return coord >= 0 ? coord / size : -((-(long long)coord - 1) / size) - 1;
+}
+
+unsigned CInsimGrid::bucket(int cx, int cy)
+{
+    return ((unsigned)cx * 73856093u ^ (unsigned)cy * 19349663u) & (IS_GRID_BUCKETS - 1);
+}
+
+void CInsimGrid::link(byte PLID)
+{
+    byte* h = &head[bucket(cellX[PLID], cellY[PLID])];
+
+    prev[PLID] = 0;
+    next[PLID] = *h;
+    if (*h)
+        prev[*h] = PLID;
+    *h = PLID;
+}
+
+void CInsimGrid::unlink(byte PLID)
+{
+    if (prev[PLID])
+        next[prev[PLID]] = next[PLID];
+    else
+        head[bucket(cellX[PLID], cellY[PLID])] = next[PLID];
+
+    if (next[PLID])
+        prev[next[PLID]] = prev[PLID];
+}
+
+void CInsimGrid::remove(byte PLID)
+{
+    if (!inGrid[PLID])
+        return;
+
+    unlink(PLID);
+    inGrid[PLID] = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (plids[i] == PLID)
+        {
+            plids[i] = plids[--count];
+            break;
+        }
+    }
+}
+
+void CInsimGrid::update(const struct mciFrame* frame)
+{
+    for (int c = 0; c < frame->numCars; c++)
+    {
+        const CompCar* car = &frame->cars[c];
+        byte p = car->PLID;
+
+        if (p == 0)
+            continue;
+
+        int cx = cell(car->X);
+        int cy = cell(car->Y);
+
+        X[p] = car->X;
+        Y[p] = car->Y;
+        lastSeq[p] = frame->seq;
+
+        if (!inGrid[p])
+        {
+            cellX[p] = cx;
+            cellY[p] = cy;
+            link(p);
+            inGrid[p] = 1;
+            plids[count++] = p;
+        }
+        else if (cx != cellX[p] || cy != cellY[p])     // Most cars stay in their cell between frames
+        {
+            unlink(p);
+            cellX[p] = cx;
+            cellY[p] = cy;
+            link(p);
+        }
+    }
+
+    // Cars that left the race
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (lastSeq[plids[i]] != frame->seq)
+            remove(plids[i]);
+    }
+}
+
+int CInsimGrid::radius(int x, int y, float metres, byte* out, int max, byte exclude)
+{
+    long long r = (long long)(metres * 65536.0f);
+    long long r2 = r * r;
+    int found = 0;
+
+    int cx0 = cell(x - r < INT_MIN ? INT_MIN : x - r);
+    int cx1 = cell(x + r > INT_MAX ? INT_MAX : x + r);
+    int cy0 = cell(y - r < INT_MIN ? INT_MIN : y - r);
+    int cy1 = cell(y + r > INT_MAX ? INT_MAX : y + r);
+
+    // A radius spanning more cells than there are cars: just check them all
+    if ((long long)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > count)
+    {
+        for (int i = 0; i < count && found < max; i++)
+        {
+            byte p = plids[i];
+            long long dx = X[p] - (long long)x, dy = Y[p] - (long long)y;
+
+            if (p != exclude && dx * dx + dy * dy <= r2)
+                out[found++] = p;
+        }
+        return found;
+    }
+
+    for (int cx = cx0; cx <= cx1; cx++)
+    {
+        for (int cy = cy0; cy <= cy1; cy++)
+        {
+            for (byte p = head[bucket(cx, cy)]; p != 0; p = next[p])
+            {
+                // Buckets are shared by several cells
+                if (cellX[p] != cx || cellY[p] != cy || p == exclude)
+                    continue;
+
+                long long dx = X[p] - (long long)x, dy = Y[p] - (long long)y;
+
+                if (dx * dx + dy * dy <= r2)
+                {
+                    out[found++] = p;
+                    if (found == max)
+                        return found;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+int CInsimGrid::radius(byte PLID, float metres, byte* out, int max)
+{
+    if (!inGrid[PLID])
+        return -1;
+
+    return radius(X[PLID], Y[PLID], metres, out, max, PLID);
+}
+
+int CInsimGrid::nearest(int x, int y, int k, byte* out, byte exclude)
+{
+    long long dist[256];
+    int found = 0;
+    int candidates = count - (exclude && inGrid[exclude] ? 1 : 0);
+    int seen = 0;
+
+    if (k > candidates)
+        k = candidates;
+
+    if (k <= 0)
+        return 0;
+
+    int cx = cell(x);
+    int cy = cell(y);
+
+    // Keeps the k closest so far in out[], sorted by distance
+    auto consider = [&](byte p)
+    {
+        long long dx = X[p] - (long long)x, dy = Y[p] - (long long)y;
+        long long d = dx * dx + dy * dy;
+
+        if (found == k && d >= dist[k - 1])
+            return;
+
+        int i = found < k ? found++ : k - 1;
+        while (i > 0 && dist[i - 1] > d)
+        {
+            dist[i] = dist[i - 1];
+            out[i] = out[i - 1];
+            i--;
+        }
+        dist[i] = d;
+        out[i] = p;
+    };
+
+    for (int n = 0; n <= IS_GRID_MAX_RINGS; n++)
+    {
+        // The cells at exactly n cells from ours
+        for (int dx = -n; dx <= n; dx++)
+        {
+            for (int dy = -n; dy <= n; dy += (dx == -n || dx == n) ? 1 : 2 * n)
+            {
+                for (byte p = head[bucket(cx + dx, cy + dy)]; p != 0; p = next[p])
+                {
+                    if (cellX[p] != cx + dx || cellY[p] != cy + dy || p == exclude)
+                        continue;
+
+                    consider(p);
+                    seen++;
+                }
+
+                if (n == 0)
+                    break;
+            }
+        }
+
+        // Every car beyond this ring is at least n cells away
+        long long bound = n * size;
+        if (seen == candidates || (found == k && dist[k - 1] <= bound * bound))
+            return found;
+    }
+
+    // Sparse cars: a plain scan is cheaper than more rings
+    found = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (plids[i] != exclude)
+            consider(plids[i]);
+    }
+
+    return found;
+}
+
+int CInsimGrid::nearest(byte PLID, int k, byte* out)
+{
+    if (!inGrid[PLID])
+        return -1;
+
+    return nearest(X[PLID], Y[PLID], k, out, PLID);
+}
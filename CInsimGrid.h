@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimGrid
+ * ==========
+ *
+ * Uniform grid over the cars for proximity queries. The map is divided into
+ * square cells of a fixed size in the fixed point units of CompCar (65536 = 1
+ * metre). Cells are hashed into a small table of buckets, each holding an
+ * intrusive list of the cars in it, so the grid covers any track without
+ * allocating.
+ *
+ * update() moves only the cars that changed cell since the previous frame, and
+ * queries visit the cells around the point of interest instead of every pair
+ * of cars. Distances are measured on the X/Y plane.
+ */
+
+#ifndef _CINSIMGRID_H
+#define _CINSIMGRID_H
+
+#include "CInsimFrames.h"
+
+#define IS_GRID_CELL 16                 // Default cell size (metres)
+#define IS_GRID_BUCKETS 256             // Hash buckets, a power of two
+
+/**
+* CInsimGrid class to find the cars around a car or a point
+*/
+class CInsimGrid
+{
+  private:
+    long long size;                     // Cell size (1/65536 m)
+
+    int X[256], Y[256];                 // Last position of each PLID
+    int cellX[256], cellY[256];         // Its cell
+    byte inGrid[256];                   // 1 if the PLID is in the grid
+    unsigned lastSeq[256];              // Last frame that contained the PLID
+    byte next[256], prev[256];          // Bucket lists, chained through the PLIDs (0 = none)
+    byte head[IS_GRID_BUCKETS];
+
+    byte plids[256];                    // PLIDs in the grid
+    int count;
+
+    int cell(int coord);
+    unsigned bucket(int cx, int cy);
+    void link(byte PLID);
+    void unlink(byte PLID);
+
+  public:
+    CInsimGrid(unsigned cellMetres = IS_GRID_CELL);
+
+    void clear();
+    void update(const struct mciFrame* frame);     // Moves the cars of a frame, removes those not in it
+    void remove(byte PLID);
+
+    /** @brief Cars within a distance of a point
+     *
+     * @param int X map (65536 = 1 metre)
+     * @param int Y map (65536 = 1 metre)
+     * @param float Radius in metres
+     * @param byte* PLIDs found, in no particular order
+     * @param int Size of the output array
+     * @param byte PLID to leave out (0 = none)
+     * @return int Number of PLIDs written
+     *
+     */
+    int radius(int x, int y, float metres, byte* out, int max, byte exclude = 0);
+    int radius(byte PLID, float metres, byte* out, int max);   // Around a car, the car itself left out. -1 if not in the grid
+
+    /** @brief The k cars closest to a point
+     *
+     * @param int X map (65536 = 1 metre)
+     * @param int Y map (65536 = 1 metre)
+     * @param int k
+     * @param byte* PLIDs found, closest first
+     * @param byte PLID to leave out (0 = none)
+     * @return int Number of PLIDs written (less than k if there aren't enough cars)
+     *
+     */
+    int nearest(int x, int y, int k, byte* out, byte exclude = 0);
+    int nearest(byte PLID, int k, byte* out);       // Around a car, the car itself left out. -1 if not in the grid
+
+    int carCount() { return count; }
+};
+
+#endif
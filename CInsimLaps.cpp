@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimLaps
+ * ==========
+ *
+ * Columnar lap history. See CInsimLaps.h
+ */
+
+#include <CInsimLaps.h>
+
+#define IS_LAPS_UNSET 0xFFFFFFFF        // Base of a column with no value yet
+
+CInsimLaps::CInsimLaps()
+{
+    blocks = 0;
+    clear();
+}
+
+CInsimLaps::~CInsimLaps()
+{
+    for (size_t i = 0; i < chunks.size(); i++)
+        delete[] chunks[i];
+}
+
+void CInsimLaps::clear()
+{
+    // The arena is kept for reuse
+    blocks = 0;
+    series.clear();
+    seriesIndex.clear();
+    names.clear();
+    nameIndex.clear();
+    session = -1;
+    numSplits = 3;
+
+    for (int i = 0; i < 256; i++)
+        ucidName[i].clear();
+
+    memset(plDriver, -1, sizeof(plDriver));
+    memset(splitTime, 0, sizeof(splitTime));
+}
+
+int CInsimLaps::new_block(int prev)
+{
+    if (blocks == (int)chunks.size() * IS_LAPS_CHUNK)
+        chunks.push_back(new struct lapBlock[IS_LAPS_CHUNK]);
+
+    struct lapBlock* b = block(blocks);
+    b->prev = prev;
+    b->count = 0;
+
+    return blocks++;
+}
+
+static inline bool fits_word(unsigned value, unsigned base)
+{
+    return value == 0 || base == IS_LAPS_UNSET || (value >= base && value - base < IS_LAPS_NONE);
+}
+
+static inline word encode(unsigned value, unsigned base)
+{
+    return value == 0 ? IS_LAPS_NONE : value - base;
+}
+
+static inline unsigned decode_word(word value, unsigned base)
+{
+    return value == IS_LAPS_NONE ? 0 : base + value;
+}
+
+// Base that leaves room on both sides of the first value
+static inline unsigned first_base(unsigned value)
+{
+    return value == 0 ? IS_LAPS_UNSET : (value > 32767 ? value - 32767 : 0);
+}
+
+bool CInsimLaps::fits(const struct lapBlock* b, const struct lapRecord* lap, unsigned lastETime)
+{
+    if (b->count == IS_LAPS_BLOCK || !fits_word(lap->lapTime, b->lapBase))
+        return false;
+
+    long long correction = (long long)lap->eTime - lastETime - lap->lapTime;
+    if (correction < SHRT_MIN || correction > SHRT_MAX)
+        return false;
+
+    for (int s = 0; s < IS_LAPS_SECTORS; s++)
+    {
+        if (!fits_word(lap->sectors[s], b->sectorBase[s]))
+            return false;
+    }
+
+    return true;
+}
+
+int CInsimLaps::intern(const std::string& name)
+{
+    std::map<std::string, int>::iterator it = nameIndex.find(name);
+    if (it != nameIndex.end())
+        return it->second;
+
+    names.push_back(name);
+    nameIndex[name] = names.size() - 1;
+    return names.size() - 1;
+}
+
+void CInsimLaps::append(int driver, const struct lapRecord* lap)
+{
+    unsigned long long key = (unsigned long long)session << 32 | (unsigned)driver;
+    std::map<unsigned long long, int>::iterator it = seriesIndex.find(key);
+    struct lapSeries* s;
+
+    if (it == seriesIndex.end())
+    {
+        struct lapSeries created = {-1, 0, 0};
+        series.push_back(created);
+        seriesIndex[key] = series.size() - 1;
+        s = &series.back();
+    }
+    else
+        s = &series[it->second];
+
+    struct lapBlock* b = s->last >= 0 ? block(s->last) : nullptr;
+
+    if (!b || !fits(b, lap, s->lastETime))
+    {
+        s->last = new_block(s->last);
+        b = block(s->last);
+        b->lapBase = first_base(lap->lapTime);
+        b->eBase = lap->eTime;
+        for (int k = 0; k < IS_LAPS_SECTORS; k++)
+            b->sectorBase[k] = first_base(lap->sectors[k]);
+    }
+
+    int i = b->count++;
+
+    if (b->lapBase == IS_LAPS_UNSET && lap->lapTime)
+        b->lapBase = first_base(lap->lapTime);
+
+    b->lap[i] = lap->lap;
+    b->lapTime[i] = encode(lap->lapTime, b->lapBase);
+    b->eTime[i] = i == 0 ? 0 : (short)((long long)lap->eTime - s->lastETime - lap->lapTime);
+
+    for (int k = 0; k < IS_LAPS_SECTORS; k++)
+    {
+        if (b->sectorBase[k] == IS_LAPS_UNSET && lap->sectors[k])
+            b->sectorBase[k] = first_base(lap->sectors[k]);
+
+        b->sectors[k][i] = encode(lap->sectors[k], b->sectorBase[k]);
+    }
+
+    s->lastETime = lap->eTime;
+    s->count++;
+}
+
+void CInsimLaps::decode(const struct lapBlock* b, int i, unsigned eTime, struct lapRecord* out)
+{
+    out->lap = b->lap[i];
+    out->lapTime = decode_word(b->lapTime[i], b->lapBase);
+    out->eTime = eTime;
+
+    for (int k = 0; k < IS_LAPS_SECTORS; k++)
+        out->sectors[k] = decode_word(b->sectors[k][i], b->sectorBase[k]);
+}
+
+void CInsimLaps::update(void* packet)
+{
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_RST:
+        {
+            struct IS_RST* rst = (struct IS_RST*)packet;
+
+            // A reply to TINY_RST describes the session already going on
+            if (rst->ReqI == 0 || session < 0)
+                session++;
+
+            // Checkpoints of the lap timing in use, none if there is no lap timing
+            numSplits = (rst->Timing & 0xc0) != 0xc0 ? rst->Timing & 0x03 : 0;
+            memset(splitTime, 0, sizeof(splitTime));
+            break;
+        }
+
+        case ISP_NCN:
+        {
+            struct IS_NCN* ncn = (struct IS_NCN*)packet;
+            ucidName[ncn->UCID].assign(ncn->UName, strnlen(ncn->UName, sizeof(ncn->UName)));
+            break;
+        }
+
+        case ISP_CNL:
+            ucidName[((struct IS_CNL*)packet)->UCID].clear();
+            break;
+
+        case ISP_NPL:
+        {
+            struct IS_NPL* npl = (struct IS_NPL*)packet;
+
+            if (npl->NumP == 0)
+                break;
+
+            // PType bit 1: AI drivers share the username of their connection
+            if ((npl->PType & 2) || ucidName[npl->UCID].empty())
+                plDriver[npl->PLID] = intern(std::string(npl->PName, strnlen(npl->PName, sizeof(npl->PName))));
+            else
+                plDriver[npl->PLID] = intern(ucidName[npl->UCID]);
+
+            memset(splitTime[npl->PLID], 0, sizeof(splitTime[npl->PLID]));
+            break;
+        }
+
+        case ISP_PLL:
+            plDriver[((struct IS_PLL*)packet)->PLID] = -1;
+            break;
+
+        case ISP_TOC:
+        {
+            struct IS_TOC* toc = (struct IS_TOC*)packet;
+
+            if (!ucidName[toc->NewUCID].empty())
+                plDriver[toc->PLID] = intern(ucidName[toc->NewUCID]);
+            break;
+        }
+
+        case ISP_SPX:
+        {
+            struct IS_SPX* spx = (struct IS_SPX*)packet;
+
+            if (spx->Split >= 1 && spx->Split <= 3)
+                splitTime[spx->PLID][spx->Split - 1] = spx->STime;
+            break;
+        }
+
+        case ISP_LAP:
+        {
+            struct IS_LAP* lap = (struct IS_LAP*)packet;
+            unsigned* split = splitTime[lap->PLID];
+            int driver = plDriver[lap->PLID];
+
+            if (driver < 0 || session < 0)
+                break;
+
+            struct lapRecord rec;
+            rec.lap = lap->LapsDone;
+            rec.lapTime = lap->LTime;
+            rec.eTime = lap->ETime;
+
+            // Sector k runs from split k-1 (or the start of the lap) to split k (or the finish line)
+            unsigned from = 0;
+            bool known = true;
+
+            for (int k = 0; k < IS_LAPS_SECTORS; k++)
+            {
+                unsigned to = k < numSplits ? split[k] : (k == numSplits ? lap->LTime : 0);
+
+                rec.sectors[k] = (known && to > from) ? to - from : 0;
+                known = to != 0;
+                from = to;
+            }
+
+            append(driver, &rec);
+            memset(split, 0, sizeof(splitTime[0]));
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_MPE)
+            {
+                for (int i = 0; i < 256; i++)
+                    ucidName[i].clear();
+            }
+            break;
+    }
+}
+
+int CInsimLaps::getDriver(const std::string& name)
+{
+    std::map<std::string, int>::iterator it = nameIndex.find(name);
+    return it == nameIndex.end() ? -1 : it->second;
+}
+
+const std::string& CInsimLaps::getDriverName(int driver)
+{
+    if (driver < 0 || driver >= (int)names.size()) {
+        throw new std::logic_error("CInsimLaps: unknown driver");
+    }
+
+    return names[driver];
+}
+
+int CInsimLaps::lapCount(int driver, int session)
+{
+    std::map<unsigned long long, int>::iterator it = seriesIndex.find((unsigned long long)session << 32 | (unsigned)driver);
+    return it == seriesIndex.end() ? 0 : series[it->second].count;
+}
+
+/**
+* Calls func(block, first, end) for each block holding some of the last laps of a series, newest block first
+*/
+template <typename F> void CInsimLaps::last_laps(int driver, int session, int laps, F func)
+{
+    std::map<unsigned long long, int>::iterator it = seriesIndex.find((unsigned long long)session << 32 | (unsigned)driver);
+
+    if (it == seriesIndex.end())
+        return;
+
+    int left = laps > 0 ? laps : series[it->second].count;
+
+    for (int i = series[it->second].last; i >= 0 && left > 0; )
+    {
+        const struct lapBlock* b = block(i);
+        int first = b->count > left ? b->count - left : 0;
+
+        func(b, first, b->count);
+        left -= b->count - first;
+        i = b->prev;
+    }
+}
+
+int CInsimLaps::getLaps(int driver, int session, int from, int count, struct lapRecord* out)
+{
+    int total = lapCount(driver, session);
+
+    if (from < 0 || count <= 0 || from >= total)
+        return 0;
+
+    if (count > total - from)
+        count = total - from;
+
+    // Blocks are chained backwards: walk from the end, decoding from the right lap of each block
+    int end = from + count;
+    int done = 0;
+    int blockEnd = total;
+
+    last_laps(driver, session, total - from, [&](const struct lapBlock* b, int first, int n)
+    {
+        int blockStart = blockEnd - (n - first);
+        unsigned eTime = b->eBase;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (i > 0)
+                eTime += decode_word(b->lapTime[i], b->lapBase) + b->eTime[i];
+
+            int index = blockStart - first + i;
+            if (index >= from && index < end)
+            {
+                decode(b, i, eTime, &out[index - from]);
+                done++;
+            }
+        }
+
+        blockEnd = blockStart;
+    });
+
+    return done;
+}
+
+unsigned CInsimLaps::best(int driver, int session, int sector, int laps)
+{
+    if (sector < 0 || sector > IS_LAPS_SECTORS)
+        return 0;
+
+    unsigned result = 0;
+
+    last_laps(driver, session, laps, [&](const struct lapBlock* b, int first, int end)
+    {
+        const word* column = sector == 0 ? b->lapTime : b->sectors[sector - 1];
+        unsigned base = sector == 0 ? b->lapBase : b->sectorBase[sector - 1];
+        word low = IS_LAPS_NONE;
+
+        // Missing times are encoded above any valid one
+        for (int i = first; i < end; i++)
+            low = column[i] < low ? column[i] : low;
+
+        unsigned t = decode_word(low, base);
+        if (t && (!result || t < result))
+            result = t;
+    });
+
+    return result;
+}
+
+size_t CInsimLaps::memoryUsed()
+{
+    return chunks.size() * IS_LAPS_CHUNK * sizeof(struct lapBlock);
+}
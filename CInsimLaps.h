@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimLaps
+ * ==========
+ *
+ * Lap history of whole seasons kept in memory. Every IS_LAP, with the IS_SPX
+ * of the same lap, is appended to the series of its driver in the current
+ * session. A session starts with each IS_RST that isn't a reply to TINY_RST.
+ * Drivers are identified by their username (their nickname for AI drivers),
+ * so they keep their history across reconnections.
+ *
+ * The laps of a series are stored column by column in blocks of
+ * IS_LAPS_BLOCK laps. Times are 16 bit offsets from a base of their block
+ * and column (lap time, sectors), and the elapsed time only keeps what lap
+ * times don't already tell, so a lap with its splits takes 14 bytes. A value
+ * that doesn't fit starts a new block. Sector k is the time from split k-1
+ * to split k, as placed by IS_RST Split1..3, and the last sector ends at the
+ * finish line.
+ *
+ * Blocks come from an arena grown IS_LAPS_CHUNK blocks at a time and never
+ * moved or freed until clear(). Queries such as the best sector of the last
+ * N laps scan one contiguous column per block.
+ */
+
+#ifndef _CINSIMLAPS_H
+#define _CINSIMLAPS_H
+
+#include "CInsim.h"
+
+#include <map>
+
+#define IS_LAPS_BLOCK 64                // Laps per block
+#define IS_LAPS_CHUNK 256               // Blocks added to the arena at a time
+#define IS_LAPS_SECTORS 4               // Up to 3 splits
+#define IS_LAPS_NONE 0xFFFF             // Encoded missing time, above every valid one
+
+// A lap decoded from the store. Times in ms, 0 if missing
+struct lapRecord
+{
+    word        lap;                    // Laps done at the end of this lap
+    unsigned    lapTime;
+    unsigned    eTime;                  // Total race time at the end of the lap
+    unsigned    sectors[IS_LAPS_SECTORS];
+};
+
+/**
+* CInsimLaps class to store the laps of every driver and session
+*/
+class CInsimLaps
+{
+  private:
+    struct lapBlock
+    {
+        int         prev;               // Previous block of the same series, -1 if first
+        int         count;              // Laps stored
+        unsigned    lapBase;
+        unsigned    eBase;              // ETime of the first lap
+        unsigned    sectorBase[IS_LAPS_SECTORS];
+
+        word        lap[IS_LAPS_BLOCK];
+        word        lapTime[IS_LAPS_BLOCK];                     // - lapBase
+        short       eTime[IS_LAPS_BLOCK];                       // - (previous ETime + lap time)
+        word        sectors[IS_LAPS_SECTORS][IS_LAPS_BLOCK];    // - sectorBase
+    };
+
+    // Laps of one driver in one session
+    struct lapSeries
+    {
+        int         last;               // Last block, -1 if none
+        int         count;
+        unsigned    lastETime;
+    };
+
+    std::vector<struct lapBlock*> chunks;       // The arena
+    int blocks;                         // Blocks handed out
+
+    std::vector<struct lapSeries> series;
+    std::map<unsigned long long, int> seriesIndex;      // session << 32 | driver
+    std::vector<std::string> names;
+    std::map<std::string, int> nameIndex;
+
+    int session;                        // Current session, -1 before the first IS_RST
+    int numSplits;
+
+    std::string ucidName[256];          // Username of each connection
+    int plDriver[256];                  // Driver of each PLID, -1 if none
+    unsigned splitTime[256][3];         // Splits of the current lap, 0 if not crossed
+
+    struct lapBlock* block(int index) { return &chunks[index / IS_LAPS_CHUNK][index % IS_LAPS_CHUNK]; }
+    int new_block(int prev);
+    bool fits(const struct lapBlock* b, const struct lapRecord* lap, unsigned lastETime);
+    int intern(const std::string& name);
+    void append(int driver, const struct lapRecord* lap);
+    void decode(const struct lapBlock* b, int i, unsigned eTime, struct lapRecord* out);
+
+    template <typename F> void last_laps(int driver, int session, int laps, F func);
+
+  public:
+    CInsimLaps();
+    ~CInsimLaps();
+
+    void clear();                       // Forgets every lap, driver and session
+    void update(void* packet);          // Applies an IS_RST, IS_NCN, IS_CNL, IS_NPL, IS_PLL, IS_TOC, IS_SPX or IS_LAP. Other types are ignored
+
+    int getSession() { return session; }
+    int getDriver(const std::string& name);     // -1 if unknown
+    const std::string& getDriverName(int driver);
+    int driverCount() { return names.size(); }
+
+    int lapCount(int driver, int session);      // 0 if none
+
+    /** @brief Decode a range of laps
+     *
+     * @param int Driver
+     * @param int Session
+     * @param int First lap, 0 = the first stored
+     * @param int Number of laps
+     * @param lapRecord* Output
+     * @return int Laps decoded
+     *
+     */
+    int getLaps(int driver, int session, int from, int count, struct lapRecord* out);
+
+    /** @brief Best time over the last laps of a series
+     *
+     * @param int Driver
+     * @param int Session
+     * @param int Sector (1 to IS_LAPS_SECTORS), or 0 for the lap time
+     * @param int How many laps back to look, 0 = all
+     * @return unsigned Best time (ms), 0 if none
+     *
+     */
+    unsigned best(int driver, int session, int sector, int laps = 0);
+
+    size_t memoryUsed();                // Bytes held by the arena
+};
+
+#endif
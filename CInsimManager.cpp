@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimManager
+ * =============
+ *
+ * Single event loop for several InSim hosts. See CInsimManager.h
+ */
+
+#include <CInsimManager.h>
+#include <CInsimOutGauge.h>
+
+#include <thread>
+
+CInsimManager::CInsimManager()
+{
+}
+
+CInsimManager::~CInsimManager()
+{
+}
+
+/**
+* Take over a connection. Hosts must be added before any thread starts calling poll()
+*/
+int CInsimManager::addHost(CInsim&& insim)
+{
+    hosts.emplace_back(new CInsim(std::move(insim)));
+    retry_at.push_back(std::chrono::steady_clock::now());
+    return hosts.size() - 1;
+}
+
+CInsim* CInsimManager::getHost(int host)
+{
+    if (host < 0 || host >= (int)hosts.size())
+        return nullptr;
+
+    return hosts[host].get();
+}
+
+int CInsimManager::hostCount()
+{
+    return hosts.size();
+}
+
+/**
+* Add an OutGauge receiver to the loop. Like hosts, before any thread starts calling poll()
+*/
+int CInsimManager::addOutGauge(CInsimOutGauge* gauge)
+{
+    gauges.push_back(gauge);
+    return gauges.size() - 1;
+}
+
+void CInsimManager::setDispatch(dispatchFunc func)
+{
+    dispatch = func;
+}
+
+void CInsimManager::setDisconnect(disconnectFunc func)
+{
+    on_disconnect = func;
+}
+
+int CInsimManager::init()
+{
+    int failed = 0;
+
+    for (size_t i = 0; i < hosts.size(); i++)
+    {
+        if (hosts[i]->isConnected())
+            continue;
+
+        if (hosts[i]->init() < 0)
+        {
+            #ifdef IS_DEBUG
+            std::cout << "CInsimManager::init - Host " << i << " could not be initialised" << std::endl;
+            #endif // IS_DEBUG
+            schedule(i);
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+int CInsimManager::disconnect()
+{
+    int rc = 0;
+
+    for (size_t i = 0; i < hosts.size(); i++)
+    {
+        if (hosts[i]->isConnected() && hosts[i]->disconnect() < 0)
+            rc = -1;
+    }
+
+    return rc;
+}
+
+void CInsimManager::drop(int host, int status)
+{
+    CInsim* insim = hosts[host].get();
+
+    #ifdef IS_DEBUG
+    std::cout << "CInsimManager::poll - Lost connection to host " << host << std::endl;
+    #endif // IS_DEBUG
+
+    insim->disconnect();
+    schedule(host);
+
+    if (on_disconnect)
+        on_disconnect(host, insim, status);
+}
+
+void CInsimManager::schedule(int host)
+{
+    retry_at[host] = std::chrono::steady_clock::now() + std::chrono::milliseconds(hosts[host]->reconnectDelay());
+}
+
+/**
+* Start reconnecting the hosts whose backoff delay has elapsed, and check the connections
+* and IS_VER replies in progress. Nothing here waits: a host that doesn't answer goes
+* back to its backoff schedule once its connection timeout expires
+* Returns how long poll() may wait before the next attempt or timeout is due (capped to timeout_ms)
+*/
+int CInsimManager::retry(int timeout_ms, unsigned shard, unsigned shards)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    for (size_t i = shard; i < hosts.size(); i += shards)
+    {
+        CInsim* insim = hosts[i].get();
+        int wait;
+
+        if (insim->connectWait() >= 0)
+        {
+            if (insim->reconnectStep() < 0)
+                schedule(i);
+        }
+        else if (insim->isConnected() || !insim->getReconnect())
+            continue;
+        else if (now >= retry_at[i] && insim->reconnectStart() < 0)
+            schedule(i);
+
+        now = std::chrono::steady_clock::now();
+
+        if (insim->connectWait() >= 0)
+            wait = insim->connectWait();
+        else if (!insim->isConnected())
+            wait = std::chrono::duration_cast<std::chrono::milliseconds>(retry_at[i] - now).count();
+        else
+            continue;
+
+        if (timeout_ms < 0 || wait < timeout_ms)
+            timeout_ms = wait < 0 ? 0 : wait;
+    }
+
+    return timeout_ms;
+}
+
+int CInsimManager::poll(int timeout_ms, unsigned shard, unsigned shards)
+{
+    fd_set readfd, writefd, exceptfd;
+    int maxfd = -1;
+    int count = 0;
+
+    if (shards == 0)
+        shards = 1;
+
+    timeout_ms = retry(timeout_ms, shard, shards);
+
+    FD_ZERO(&readfd);
+    FD_ZERO(&writefd);
+    FD_ZERO(&exceptfd);
+
+    for (size_t i = shard; i < hosts.size(); i += shards)
+    {
+        CInsim* insim = hosts[i].get();
+
+        // Reconnections in progress: writable once the connection is established (or refused)
+        if (insim->isConnecting())
+        {
+            FD_SET(insim->getSocket(), &writefd);
+            if ((int)insim->getSocket() > maxfd)
+                maxfd = insim->getSocket();
+            continue;
+        }
+
+        if (!insim->isConnected())
+            continue;
+
+        // Packets left over from a previous read are dispatched before waiting again
+        int rc;
+        while ((rc = insim->poll_packet()) > 0)
+        {
+            if (dispatch)
+                dispatch(i, insim, insim->get_packet());
+            count++;
+        }
+
+        if (rc < 0)
+        {
+            drop(i, -1);
+            continue;
+        }
+
+        FD_SET(insim->getSocket(), &readfd);
+        FD_SET(insim->getSocket(), &exceptfd);
+        if ((int)insim->getSocket() > maxfd)
+            maxfd = insim->getSocket();
+
+        if (insim->getUDPSocket() != INVALID_SOCKET)
+        {
+            FD_SET(insim->getUDPSocket(), &readfd);
+            if ((int)insim->getUDPSocket() > maxfd)
+                maxfd = insim->getUDPSocket();
+        }
+    }
+
+    for (size_t i = shard; i < gauges.size(); i += shards)
+    {
+        if (gauges[i]->getSocket() == INVALID_SOCKET)
+            continue;
+
+        FD_SET(gauges[i]->getSocket(), &readfd);
+        if ((int)gauges[i]->getSocket() > maxfd)
+            maxfd = gauges[i]->getSocket();
+    }
+
+    // Nothing to wait for but reconnections
+    if (maxfd < 0)
+    {
+        if (count == 0 && timeout_ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return count;
+    }
+
+    // Don't wait if we already have something to hand back
+    if (count > 0)
+        timeout_ms = 0;
+
+    #ifdef CIS_WINDOWS
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int rc = select(0, &readfd, &writefd, &exceptfd, timeout_ms < 0 ? NULL : &tv);
+    #elif defined CIS_LINUX
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    int rc = pselect(maxfd + 1, &readfd, &writefd, &exceptfd, timeout_ms < 0 ? NULL : &ts, NULL);
+    #endif
+
+    if (rc < 0)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimManager::poll - An error occured" << std::endl;
+        #endif // IS_DEBUG
+        return -1;
+    }
+
+    if (rc == 0)
+        return count;
+
+    for (size_t i = shard; i < gauges.size(); i += shards)
+    {
+        if (gauges[i]->getSocket() == INVALID_SOCKET || !FD_ISSET(gauges[i]->getSocket(), &readfd))
+            continue;
+
+        int stored = gauges[i]->poll();
+        if (stored > 0)
+            count += stored;
+    }
+
+    for (size_t i = shard; i < hosts.size(); i += shards)
+    {
+        CInsim* insim = hosts[i].get();
+
+        if (insim->isConnecting())
+        {
+            if (FD_ISSET(insim->getSocket(), &writefd) && insim->reconnectStep() < 0)
+                schedule(i);
+            continue;
+        }
+
+        if (!insim->isConnected())
+            continue;
+
+        if (insim->getUDPSocket() != INVALID_SOCKET && FD_ISSET(insim->getUDPSocket(), &readfd))
+        {
+            if (insim->udp_recv_packet() > 0)
+            {
+                if (dispatch)
+                    dispatch(i, insim, insim->udp_get_packet());
+                count++;
+            }
+        }
+
+        if (FD_ISSET(insim->getSocket(), &exceptfd))
+        {
+            drop(i, -1);
+            continue;
+        }
+
+        if (!FD_ISSET(insim->getSocket(), &readfd))
+            continue;
+
+        int retval = insim->recv_data();
+
+        if (retval < 0)
+        {
+            drop(i, retval);
+            continue;
+        }
+
+        while ((retval = insim->poll_packet()) > 0)
+        {
+            if (dispatch)
+                dispatch(i, insim, insim->get_packet());
+            count++;
+        }
+
+        if (retval < 0)
+            drop(i, -1);
+    }
+
+    return count;
+}
+
+struct insimStats CInsimManager::getStats(int host)
+{
+    CInsim* insim = getHost(host);
+
+    if (!insim)
+    {
+        struct insimStats st;
+        memset(&st, 0, sizeof(st));
+        return st;
+    }
+
+    return insim->getStats();
+}
+
+struct insimStats CInsimManager::getStats()
+{
+    struct insimStats total;
+    memset(&total, 0, sizeof(total));
+
+    for (size_t i = 0; i < hosts.size(); i++)
+    {
+        struct insimStats st = hosts[i]->getStats();
+        total.packetsIn += st.packetsIn;
+        total.bytesIn += st.bytesIn;
+        total.packetsOut += st.packetsOut;
+        total.bytesOut += st.bytesOut;
+    }
+
+    return total;
+}
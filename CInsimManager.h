@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimManager
+ * =============
+ *
+ * Services several InSim hosts from a single event loop. The manager owns one
+ * CInsim per host and waits on all their TCP and UDP sockets with a single
+ * select() call, then hands every packet to one dispatch callback tagged with
+ * the host id. Packets are dispatched in place from each connection's own
+ * buffer, so the loop neither copies nor allocates.
+ *
+ * Hosts can be split between several threads: each thread calls poll() with
+ * its own shard number and only services the hosts assigned to that shard.
+ *
+ * Hosts with CInsim::setReconnect() enabled are reconnected by poll() itself
+ * once their backoff delay has elapsed, without blocking the other hosts: the
+ * TCP connection is waited on in the same select() call and the IS_VER reply
+ * arrives like any other packet (CInsim::reconnectStart()). A host that
+ * doesn't connect or answer within its connection timeout goes back to its
+ * backoff schedule.
+ *
+ * OutGauge receivers added with addOutGauge() are waited on in the same
+ * select() call and drained by poll(), through their own callbacks.
+ */
+
+#ifndef _CINSIMMANAGER_H
+#define _CINSIMMANAGER_H
+
+#include "CInsim.h"
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+
+class CInsimOutGauge;
+
+/**
+* CInsimManager class to run many Insim connections on one event loop
+*/
+class CInsimManager
+{
+  public:
+    // Called for each packet received from any host. "packet" must be casted, as with CInsim::get_packet()
+    typedef std::function<void (int host, CInsim* insim, void* packet)> dispatchFunc;
+    // Called when a host's connection is lost. status is -1 (error) or -2 (closed at the other end)
+    typedef std::function<void (int host, CInsim* insim, int status)> disconnectFunc;
+
+  private:
+    std::vector<std::unique_ptr<CInsim> > hosts;    // Connections, indexed by host id
+    std::vector<std::chrono::steady_clock::time_point> retry_at;   // Next reconnection attempt of each host
+    dispatchFunc dispatch;
+    disconnectFunc on_disconnect;
+    std::vector<CInsimOutGauge*> gauges;            // OutGauge receivers, not owned
+
+    void drop(int host, int status);                // Closes a lost connection and reports it
+    void schedule(int host);                        // Plans the next reconnection attempt
+    int retry(int timeout_ms, unsigned shard, unsigned shards);    // Starts and checks reconnections, returns the time to wait
+
+  public:
+    CInsimManager();
+    ~CInsimManager();
+
+    int addHost(CInsim&& insim);                    // Takes over a connection (connected or not) and returns its host id
+    CInsim* getHost(int host);                      // nullptr if the id is unknown
+    int hostCount();
+
+    int addOutGauge(CInsimOutGauge* gauge);         // Serviced by poll() in the shard index % shards. Must stay alive while poll() runs
+
+    void setDispatch(dispatchFunc func);
+    void setDisconnect(disconnectFunc func);
+
+    int init();                                     // Calls init() on every host not connected yet. Returns the number of failures
+    int disconnect();                               // Disconnects every host
+
+    /**
+     * @brief Wait for data on every host of a shard and dispatch the complete packets
+     *
+     * @param int Maximum time to wait in milliseconds (0 = just check, <0 = wait forever)
+     * @param unsigned Shard serviced by the calling thread (hosts with id % shards == shard)
+     * @param unsigned Total number of shards (threads calling poll())
+     * @return int Number of packets dispatched (and OutGauge datagrams stored), -1 on error
+     *
+     */
+    int poll(int timeout_ms, unsigned shard = 0, unsigned shards = 1);
+
+    struct insimStats getStats(int host);           // Counters of a single host
+    struct insimStats getStats();                   // Counters of all hosts combined
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimMotion
+ * ============
+ *
+ * Motion model for drawing cars between MCI updates. See CInsimMotion.h
+ */
+
+#include <CInsimMotion.h>
+
+#include <cmath>
+
+#define IS_PI 3.14159265358979f
+
+static const float POS_TO_M = 1.0f / 65536.0f;         // X, Y, Z: 65536 = 1 metre
+static const float SPEED_TO_MS = 100.0f / 32768.0f;     // Speed: 32768 = 100 m/s
+static const float ANGLE_TO_RAD = IS_PI / 32768.0f;     // Heading, Direction: 32768 = 180 deg
+static const float ANGVEL_TO_RAD = IS_PI / 8192.0f;     // AngVel: 8192 = 180 deg/s
+
+CInsimMotion::CInsimMotion()
+{
+    max_extrapolation = IS_MOTION_MAX_EXTRAPOLATION / 1000.0f;
+    clear();
+}
+
+void CInsimMotion::clear()
+{
+    count = 0;
+    seq = 0;
+    memset(lastSeq, 0, sizeof(lastSeq));
+
+    for (int p = 0; p < 256; p++)
+        slot[p] = -1;
+}
+
+void CInsimMotion::setMaxExtrapolation(unsigned ms)
+{
+    max_extrapolation = ms / 1000.0f;
+}
+
+/**
+* Apply a frame. Frames skipped by the caller just widen the interpolation span
+*/
+void CInsimMotion::update(const struct mciFrame* frame)
+{
+    if (frame->seq == seq)
+        return;
+
+    unsigned prev = seq;
+    t0 = count > 0 ? t1 : frame->time;
+    t1 = frame->time;
+
+    for (int i = 0; i < count; i++)
+        slot[plids[i]] = -1;
+
+    count = 0;
+
+    for (int c = 0; c < frame->numCars; c++)
+    {
+        const CompCar* car = &frame->cars[c];
+        byte p = car->PLID;
+        int i = count++;
+
+        plids[i] = p;
+        slot[p] = i;
+
+        // A car that wasn't in the previous frame starts still
+        bool known = prev != 0 && lastSeq[p] == prev;
+
+        x0[i] = (known ? lastX[p] : car->X) * POS_TO_M;
+        y0[i] = (known ? lastY[p] : car->Y) * POS_TO_M;
+        z0[i] = (known ? lastZ[p] : car->Z) * POS_TO_M;
+        x1[i] = car->X * POS_TO_M;
+        y1[i] = car->Y * POS_TO_M;
+        z1[i] = car->Z * POS_TO_M;
+
+        // The heading goes the shortest way round from the previous one
+        h1[i] = car->Heading * ANGLE_TO_RAD;
+        h0[i] = h1[i] - (short)(word)(car->Heading - (known ? lastHeading[p] : car->Heading)) * ANGLE_TO_RAD;
+
+        float speed = car->Speed * SPEED_TO_MS;
+        float dir = car->Direction * ANGLE_TO_RAD;
+        vx[i] = -sinf(dir) * speed;
+        vy[i] = cosf(dir) * speed;
+        w[i] = car->AngVel * ANGVEL_TO_RAD;
+
+        lastX[p] = car->X;
+        lastY[p] = car->Y;
+        lastZ[p] = car->Z;
+        lastHeading[p] = car->Heading;
+        lastSeq[p] = frame->seq;
+    }
+
+    seq = frame->seq;
+}
+
+/**
+* Interpolation weight of the previous frame and extrapolation time for a time t
+*/
+static void weights(std::chrono::steady_clock::time_point t, std::chrono::steady_clock::time_point t0,
+                    std::chrono::steady_clock::time_point t1, float max_extrapolation, float* beta, float* dt)
+{
+    float since = std::chrono::duration<float>(t - t1).count();
+    float span = std::chrono::duration<float>(t1 - t0).count();
+
+    *beta = (since < 0 && span > 0) ? -since / span : 0;
+    if (*beta > 1)
+        *beta = 1;
+
+    *dt = since < 0 ? 0 : (since > max_extrapolation ? max_extrapolation : since);
+}
+
+int CInsimMotion::predict(std::chrono::steady_clock::time_point t)
+{
+    float beta, dt;
+    weights(t, t0, t1, max_extrapolation, &beta, &dt);
+
+    for (int i = 0; i < count; i++)
+    {
+        // Velocity turned by half the heading change (mid-point of a constant rate turn),
+        // with the sine and cosine of that small angle as polynomials
+        float turn = w[i] * dt;
+        float th = turn * 0.5f;
+        float th2 = th * th;
+        float s = th * (1.0f - th2 / 6.0f + th2 * th2 / 120.0f);
+        float c = 1.0f - th2 / 2.0f + th2 * th2 / 24.0f;
+
+        X[i] = x1[i] - (x1[i] - x0[i]) * beta + (vx[i] * c - vy[i] * s) * dt;
+        Y[i] = y1[i] - (y1[i] - y0[i]) * beta + (vx[i] * s + vy[i] * c) * dt;
+        Z[i] = z1[i] - (z1[i] - z0[i]) * beta;
+        Heading[i] = h1[i] - (h1[i] - h0[i]) * beta + turn;
+    }
+
+    return count;
+}
+
+int CInsimMotion::position(byte PLID, std::chrono::steady_clock::time_point t, Vector* pos, float* heading)
+{
+    int i = slot[PLID];
+
+    if (i < 0)
+        return -1;
+
+    float beta, dt;
+    weights(t, t0, t1, max_extrapolation, &beta, &dt);
+
+    float turn = w[i] * dt;
+    float th = turn * 0.5f;
+    float th2 = th * th;
+    float s = th * (1.0f - th2 / 6.0f + th2 * th2 / 120.0f);
+    float c = 1.0f - th2 / 2.0f + th2 * th2 / 24.0f;
+
+    pos->x = x1[i] - (x1[i] - x0[i]) * beta + (vx[i] * c - vy[i] * s) * dt;
+    pos->y = y1[i] - (y1[i] - y0[i]) * beta + (vx[i] * s + vy[i] * c) * dt;
+    pos->z = z1[i] - (z1[i] - z0[i]) * beta;
+
+    if (heading)
+        *heading = h1[i] - (h1[i] - h0[i]) * beta + turn;
+
+    return 0;
+}
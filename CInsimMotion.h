@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimMotion
+ * ============
+ *
+ * Motion model for drawing cars between MCI updates. Fed with complete frames
+ * (see CInsimFrames), it answers where every car is at any time t:
+ *
+ * - Before the last frame, between the last two frames: linear interpolation
+ *   of the position and shortest way interpolation of the heading.
+ * - After the last frame: dead reckoning from Speed and Direction, turning at
+ *   the AngVel rate, for at most setMaxExtrapolation() milliseconds.
+ *
+ * predict() computes all the cars at once over plain float arrays, without
+ * branches or trigonometric calls in the loop, so it vectorises and can run
+ * every rendered frame. Positions are in metres, angles in radians
+ * anticlockwise from the world y axis, as in LFS.
+ */
+
+#ifndef _CINSIMMOTION_H
+#define _CINSIMMOTION_H
+
+#include "CInsimFrames.h"
+
+#define IS_MOTION_MAX_EXTRAPOLATION 500         // Default cap on dead reckoning (ms)
+
+/**
+* CInsimMotion class to interpolate and extrapolate car positions
+*/
+class CInsimMotion
+{
+  public:
+    // Results of predict(), in the order of plids[]
+    float X[IS_FRAME_MAX_CARS];
+    float Y[IS_FRAME_MAX_CARS];
+    float Z[IS_FRAME_MAX_CARS];
+    float Heading[IS_FRAME_MAX_CARS];
+
+    byte plids[IS_FRAME_MAX_CARS];          // Cars of the last frame
+    int count;
+
+  private:
+    // State of each car of the last frame, in the order of plids[]
+    float x0[IS_FRAME_MAX_CARS], y0[IS_FRAME_MAX_CARS], z0[IS_FRAME_MAX_CARS], h0[IS_FRAME_MAX_CARS];  // Previous frame
+    float x1[IS_FRAME_MAX_CARS], y1[IS_FRAME_MAX_CARS], z1[IS_FRAME_MAX_CARS], h1[IS_FRAME_MAX_CARS];  // Last frame
+    float vx[IS_FRAME_MAX_CARS], vy[IS_FRAME_MAX_CARS];    // Velocity (m/s)
+    float w[IS_FRAME_MAX_CARS];                             // Heading rate (rad/s)
+
+    // Last frame of every PLID, to find the previous position of the cars of a new frame
+    int lastX[256], lastY[256], lastZ[256];
+    word lastHeading[256];
+    unsigned lastSeq[256];
+    short slot[256];                        // Index of each PLID in plids[], -1 if not in the last frame
+
+    unsigned seq;                           // Last frame applied
+    std::chrono::steady_clock::time_point t0, t1;          // Times of the previous and the last frame
+    float max_extrapolation;                // (s)
+
+  public:
+    CInsimMotion();
+
+    void clear();
+    void update(const struct mciFrame* frame);     // Must be called with every frame, in order
+    void setMaxExtrapolation(unsigned ms);
+
+    int predict(std::chrono::steady_clock::time_point t);  // Fills X, Y, Z and Heading for every car. Returns count
+
+    /** @brief Position of a single car
+     *
+     * @param byte PLayer ID
+     * @param time_point Time
+     * @param Vector* Position in metres
+     * @param float* Heading in radians (can be NULL)
+     * @return int 0, or -1 if the car was not in the last frame
+     *
+     */
+    int position(byte PLID, std::chrono::steady_clock::time_point t, Vector* pos, float* heading = NULL);
+};
+
+#endif
@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimMux
+ * =========
+ *
+ * Local InSim multiplexer over UNIX domain sockets. See CInsimMux.h
+ */
+
+#include <CInsimMux.h>
+
+#ifdef CIS_LINUX
+
+#include <thread>
+
+// Size in bytes of an encoded packet
+static unsigned packet_bytes(const char* pack, byte version)
+{
+    unsigned size = (unsigned char)*pack;
+    return version > 8 ? size * 4 : size;
+}
+
+CInsimMux::CInsimMux(CInsim* upstream, const std::string path, byte buttonsPerClient)
+{
+    if (buttonsPerClient == 0 || buttonsPerClient > IS_MUX_BUTTONS) {
+        throw new std::logic_error("CInsimMux: buttonsPerClient must be between 1 and 240");
+    }
+
+    this->upstream = upstream;
+    this->path = path;
+    this->listenfd = -1;
+    this->buttons = buttonsPerClient;
+
+    // Every client has a full range of ClickIDs, so there can't be more than that
+    this->slots = IS_MUX_BUTTONS / buttonsPerClient;
+    if (this->slots > IS_MUX_MAX_CLIENTS)
+        this->slots = IS_MUX_MAX_CLIENTS;
+
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        clients[c].fd = -1;
+        clients[c].gen = 0;
+        clients[c].ready = false;
+        clients[c].buf.bytes = 0;
+    }
+
+    for (int r = 0; r < 256; r++)
+        reqmap[r].client = -1;
+
+    next_reqi = 2;
+    retry_at = std::chrono::steady_clock::now();
+}
+
+CInsimMux::~CInsimMux()
+{
+    close();
+}
+
+int CInsimMux::listen()
+{
+    struct sockaddr_un saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(saddr.sun_path))
+        return -1;
+
+    strcpy(saddr.sun_path, path.c_str());
+
+    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listenfd < 0)
+        return -1;
+
+    // Remove a socket left behind by a previous run
+    unlink(path.c_str());
+
+    if (bind(listenfd, (struct sockaddr *) &saddr, sizeof(saddr)) < 0 || ::listen(listenfd, IS_MUX_MAX_CLIENTS) < 0)
+    {
+        ::close(listenfd);
+        listenfd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void CInsimMux::close()
+{
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0)
+            drop_client(c);
+    }
+
+    if (listenfd >= 0)
+    {
+        ::close(listenfd);
+        unlink(path.c_str());
+        listenfd = -1;
+    }
+}
+
+void CInsimMux::setSubscription(const std::string name, const packetMask mask)
+{
+    subscriptions[name] = mask;
+
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0 && clients[c].ready && clients[c].name == name)
+            clients[c].mask = mask;
+    }
+}
+
+int CInsimMux::clientCount()
+{
+    int count = 0;
+
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0)
+            count++;
+    }
+
+    return count;
+}
+
+void CInsimMux::accept_client()
+{
+    int fd = accept(listenfd, NULL, NULL);
+
+    if (fd < 0)
+        return;
+
+    for (int c = 0; c < slots; c++)
+    {
+        if (clients[c].fd < 0)
+        {
+            clients[c].fd = fd;
+            clients[c].gen++;
+            clients[c].ready = false;
+            clients[c].name.clear();
+            clients[c].version = 0;
+            clients[c].mask.reset();
+            clients[c].buf.bytes = 0;
+            return;
+        }
+    }
+
+    // Refused rather than left without buttons
+    #ifdef IS_DEBUG
+    std::cout << "CInsimMux::accept_client - Too many clients, " << slots << " at most with " << (int)buttons << " buttons each" << std::endl;
+    #endif // IS_DEBUG
+    ::close(fd);
+}
+
+void CInsimMux::drop_client(int c)
+{
+    ::close(clients[c].fd);
+    clients[c].fd = -1;
+    clients[c].ready = false;
+}
+
+/**
+* Send a packet (Size in bytes) to a client, encoding the size for its InSim version
+* A client that can't keep up is disconnected, the multiplexer never waits for it
+*/
+int CInsimMux::send_client(int c, const char* pack, unsigned size)
+{
+    char out[PACKET_MAX_SIZE];
+
+    if (clients[c].version > 8)
+        out[0] = size / 4;
+    else if (size <= 255)
+        out[0] = size;
+    else
+        return 0;               // Can't be expressed with this InSim version
+
+    memcpy(out + 1, pack + 1, size - 1);
+
+    if (send(clients[c].fd, out, size, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)size)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimMux::send_client - Dropping client " << clients[c].name << std::endl;
+        #endif // IS_DEBUG
+        drop_client(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Fan an upstream packet out to the clients
+*/
+void CInsimMux::from_upstream(void* p, bool udp)
+{
+    char* pack = (char*)p;
+    unsigned size = packet_bytes(pack, upstream->getVersion());
+    byte type = pack[1];
+    byte reqi = pack[2];
+    char out[PACKET_MAX_SIZE];
+
+    if (size < 4 || size > PACKET_MAX_SIZE)
+        return;
+
+    memcpy(out, pack, size);
+
+    // Button events go to the owner of the ClickID range
+    if (type == ISP_BTC || type == ISP_BTT)
+    {
+        int c = (byte)out[4] / buttons;
+
+        if (c < IS_MUX_MAX_CLIENTS && clients[c].fd >= 0 && clients[c].ready)
+        {
+            out[4] -= c * buttons;
+            send_client(c, out, size);
+        }
+        return;
+    }
+
+    // Replies go to the requester only, with its own ReqI
+    if (!udp && reqi != 0 && reqmap[reqi].client >= 0)
+    {
+        int c = reqmap[reqi].client;
+
+        if (clients[c].fd >= 0 && clients[c].gen == reqmap[reqi].gen)
+        {
+            out[2] = reqmap[reqi].reqi;
+            send_client(c, out, size);
+        }
+        return;
+    }
+
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0 && clients[c].ready && clients[c].mask.test(type))
+            send_client(c, out, size);
+    }
+}
+
+/**
+* Handle a packet (Size in bytes) sent by a client
+*/
+void CInsimMux::from_client(int c, char* pack, unsigned size)
+{
+    struct muxClient* cl = &clients[c];
+    byte type = pack[1];
+
+    if (type == ISP_ISI)
+    {
+        struct IS_ISI* isi = (struct IS_ISI*)pack;
+
+        cl->ready = true;
+        cl->version = isi->InSimVer;
+        cl->name = std::string(isi->IName, strnlen(isi->IName, sizeof(isi->IName)));
+
+        std::map<std::string, packetMask>::iterator it = subscriptions.find(cl->name);
+        if (it != subscriptions.end())
+        {
+            cl->mask = it->second;
+        }
+        else
+        {
+            // Everything, except the optional streams the client didn't ask for
+            cl->mask.set();
+            if (!(isi->Flags & ISF_MCI)) cl->mask.reset(ISP_MCI);
+            if (!(isi->Flags & ISF_NLP)) cl->mask.reset(ISP_NLP);
+            if (!(isi->Flags & ISF_CON)) cl->mask.reset(ISP_CON);
+            if (!(isi->Flags & ISF_OBH)) cl->mask.reset(ISP_OBH);
+            if (!(isi->Flags & ISF_HLV)) cl->mask.reset(ISP_HLV);
+            if (!(isi->Flags & (ISF_AXM_LOAD | ISF_AXM_EDIT))) cl->mask.reset(ISP_AXM);
+        }
+
+        // Answer the version request ourselves
+        if (isi->ReqI != 0)
+        {
+            struct IS_VER ver;
+            memset(&ver, 0, sizeof(ver));
+            ver.Size = sizeof(ver);
+            ver.Type = ISP_VER;
+            ver.ReqI = isi->ReqI;
+            std::string version = upstream->getHostLFSVersion();
+            std::string product = upstream->getHostProduct();
+            memcpy(ver.Version, version.c_str(), strnlen(version.c_str(), sizeof(ver.Version)));
+            memcpy(ver.Product, product.c_str(), strnlen(product.c_str(), sizeof(ver.Product)));
+            ver.InSimVer = upstream->getHostVersion();
+            send_client(c, (const char*)&ver, sizeof(ver));
+        }
+        return;
+    }
+
+    if (!cl->ready)
+        return;
+
+    if (type == ISP_TINY)
+    {
+        if (pack[3] == TINY_NONE)           // Keep alive reply, upstream keep alives are our business
+            return;
+
+        if (pack[3] == TINY_CLOSE)
+        {
+            drop_client(c);
+            return;
+        }
+    }
+
+    unsigned base = c * buttons;
+
+    if (type == ISP_BTN)
+    {
+        byte click = pack[4];
+
+        if (click >= buttons)
+            return;
+
+        pack[4] = base + click;
+    }
+    else if (type == ISP_BFN)
+    {
+        struct IS_BFN* bfn = (struct IS_BFN*)pack;
+
+        if (bfn->SubT == BFN_DEL_BTN || bfn->SubT == BFN_CLEAR)
+        {
+            byte last = base + buttons - 1;
+
+            if (bfn->SubT == BFN_CLEAR)         // Only our own buttons, not the other clients'
+            {
+                bfn->SubT = BFN_DEL_BTN;
+                bfn->ClickID = base;
+                bfn->ClickMax = last;
+            }
+            else
+            {
+                if (bfn->ClickID >= buttons)
+                    return;
+
+                bfn->ClickMax = bfn->ClickMax > bfn->ClickID ? (base + bfn->ClickMax > last ? last : base + bfn->ClickMax) : 0;
+                bfn->ClickID = base + bfn->ClickID;
+            }
+        }
+    }
+    else if (pack[2] != 0)
+    {
+        // Give the request a ReqI no other client is using
+        byte r = next_reqi;
+        next_reqi = next_reqi >= IS_RESYNC_REQI - 1 ? 2 : next_reqi + 1;
+
+        reqmap[r].client = c;
+        reqmap[r].gen = cl->gen;
+        reqmap[r].reqi = pack[2];
+        pack[2] = r;
+    }
+
+    if (upstream->getVersion() > 8)
+        pack[0] = size / 4;
+    else if (size <= 255)
+        pack[0] = size;
+    else
+        return;
+
+    upstream->send_raw(pack, size);
+}
+
+/**
+* Read what a client sent and handle the complete packets
+*/
+int CInsimMux::read_client(int c)
+{
+    struct packBuffer* buf = &clients[c].buf;
+    int retval = recv(clients[c].fd, buf->buffer + buf->bytes, PACKET_BUFFER_SIZE - buf->bytes, 0);
+
+    if (retval <= 0)
+    {
+        drop_client(c);
+        return -1;
+    }
+
+    buf->bytes += retval;
+
+    unsigned offset = 0;
+    while (buf->bytes - offset >= 1)
+    {
+        // Before its IS_ISI we don't know the client's version, the IS_ISI itself tells
+        byte version = clients[c].ready ? clients[c].version : (buf->bytes - offset > 1 && buf->buffer[offset + 1] == ISP_ISI && (unsigned char)buf->buffer[offset] < sizeof(struct IS_ISI) ? 9 : 8);
+        unsigned size = packet_bytes(buf->buffer + offset, version);
+
+        if (size < 4)
+        {
+            drop_client(c);
+            return -1;
+        }
+
+        if (buf->bytes - offset < size)
+            break;
+
+        char pack[PACKET_MAX_SIZE];
+        memset(pack, 0, PACKET_MAX_SIZE);
+        memcpy(pack, buf->buffer + offset, size);
+        offset += size;
+
+        from_client(c, pack, size);
+
+        if (clients[c].fd < 0)
+            return -1;
+    }
+
+    memmove(buf->buffer, buf->buffer + offset, buf->bytes - offset);
+    buf->bytes -= offset;
+
+    return 0;
+}
+
+void CInsimMux::upstream_lost()
+{
+    #ifdef IS_DEBUG
+    std::cout << "CInsimMux::poll - Lost the upstream connection" << std::endl;
+    #endif // IS_DEBUG
+
+    upstream->disconnect();
+    retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(upstream->reconnectDelay());
+}
+
+int CInsimMux::poll(int timeout_ms)
+{
+    fd_set readfd, writefd;
+    int maxfd = -1;
+    int count = 0;
+
+    // Reconnections never block the clients: see CInsim::reconnectStart()
+    if (upstream->connectWait() >= 0 || (!upstream->isConnected() && upstream->getReconnect()))
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        int rc = 0;
+
+        if (upstream->connectWait() >= 0)
+            rc = upstream->reconnectStep();
+        else if (now >= retry_at)
+            rc = upstream->reconnectStart();
+
+        if (rc < 0)
+            retry_at = now + std::chrono::milliseconds(upstream->reconnectDelay());
+
+        int wait = upstream->connectWait();
+        if (wait < 0 && !upstream->isConnected())
+            wait = std::chrono::duration_cast<std::chrono::milliseconds>(retry_at - now).count();
+
+        if ((upstream->connectWait() >= 0 || !upstream->isConnected()) && (timeout_ms < 0 || wait < timeout_ms))
+            timeout_ms = wait < 0 ? 0 : wait;
+    }
+
+    FD_ZERO(&readfd);
+    FD_ZERO(&writefd);
+
+    if (upstream->isConnecting())
+    {
+        FD_SET(upstream->getSocket(), &writefd);
+        maxfd = upstream->getSocket();
+    }
+
+    if (upstream->isConnected())
+    {
+        // Leftovers from the previous read
+        int rc;
+        while ((rc = upstream->poll_packet()) > 0)
+        {
+            from_upstream(upstream->get_packet(), false);
+            count++;
+        }
+
+        if (rc < 0)
+            upstream_lost();
+    }
+
+    if (upstream->isConnected())
+    {
+        FD_SET(upstream->getSocket(), &readfd);
+        maxfd = upstream->getSocket();
+
+        if (upstream->getUDPSocket() != INVALID_SOCKET)
+        {
+            FD_SET(upstream->getUDPSocket(), &readfd);
+            if (upstream->getUDPSocket() > maxfd)
+                maxfd = upstream->getUDPSocket();
+        }
+    }
+
+    if (listenfd >= 0)
+    {
+        FD_SET(listenfd, &readfd);
+        if (listenfd > maxfd)
+            maxfd = listenfd;
+    }
+
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0)
+        {
+            FD_SET(clients[c].fd, &readfd);
+            if (clients[c].fd > maxfd)
+                maxfd = clients[c].fd;
+        }
+    }
+
+    if (maxfd < 0)
+    {
+        if (timeout_ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return count;
+    }
+
+    if (count > 0)
+        timeout_ms = 0;
+
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    int rc = pselect(maxfd + 1, &readfd, &writefd, NULL, timeout_ms < 0 ? NULL : &ts, NULL);
+
+    if (rc < 0)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimMux::poll - An error occured" << std::endl;
+        #endif // IS_DEBUG
+        return -1;
+    }
+
+    if (rc == 0)
+        return count;
+
+    if (upstream->isConnecting() && FD_ISSET(upstream->getSocket(), &writefd) && upstream->reconnectStep() < 0)
+        retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(upstream->reconnectDelay());
+
+    if (upstream->isConnected())
+    {
+        if (upstream->getUDPSocket() != INVALID_SOCKET && FD_ISSET(upstream->getUDPSocket(), &readfd))
+        {
+            if (upstream->udp_recv_packet() > 0)
+            {
+                from_upstream(upstream->udp_get_packet(), true);
+                count++;
+            }
+        }
+
+        if (FD_ISSET(upstream->getSocket(), &readfd))
+        {
+            if (upstream->recv_data() < 0)
+            {
+                upstream_lost();
+            }
+            else
+            {
+                while ((rc = upstream->poll_packet()) > 0)
+                {
+                    from_upstream(upstream->get_packet(), false);
+                    count++;
+                }
+
+                if (rc < 0)
+                    upstream_lost();
+            }
+        }
+    }
+
+    for (int c = 0; c < IS_MUX_MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0 && FD_ISSET(clients[c].fd, &readfd))
+            read_client(c);
+    }
+
+    if (listenfd >= 0 && FD_ISSET(listenfd, &readfd))
+        accept_client();
+
+    return count;
+}
+
+#endif // CIS_LINUX
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimMux
+ * =========
+ *
+ * Local InSim multiplexer (*NIX only). It holds the single upstream CInsim
+ * connection to LFS and lets any number of local tools share it through a UNIX
+ * domain socket. The tools are plain CInsim clients whose host name is the path
+ * of the socket (e.g. setHost("/tmp/insim.sock")).
+ *
+ * - Every upstream packet is read once and forwarded as is to the clients that
+ *   subscribed to its type. The IS_ISI flags of a client (ISF_MCI, ISF_NLP...)
+ *   give its default subscription, setSubscription() can override it by name.
+ * - Non-zero ReqI values sent by clients are rewritten to values unique on the
+ *   upstream connection, and the replies go back to the requester only with
+ *   its original ReqI.
+ * - Each client gets its own range of button ClickIDs. IS_BTN/IS_BFN are moved
+ *   into that range and IS_BTC/IS_BTT are routed back to their owner. As the
+ *   240 ClickIDs are shared, at most 240 / buttonsPerClient clients (6 with
+ *   the default 40) are accepted, and the next ones are disconnected at once.
+ * - IS_ISI and TINY_CLOSE from clients never reach LFS.
+ */
+
+#ifndef _CINSIMMUX_H
+#define _CINSIMMUX_H
+
+#include "CInsim.h"
+
+#ifdef CIS_LINUX
+
+#include <bitset>
+#include <map>
+#include <chrono>
+
+#define IS_MUX_MAX_CLIENTS 16
+#define IS_MUX_BUTTONS 240              // ClickIDs available on an InSim connection (0 to 239)
+
+typedef std::bitset<256> packetMask;    // One bit per ISP_ packet type
+
+// A local tool connected to the multiplexer
+struct muxClient
+{
+    int fd;                             // UNIX socket, -1 if the slot is free
+    unsigned gen;                       // Incremented each time the slot is reused
+    bool ready;                         // IS_ISI received
+    std::string name;                   // IName from its IS_ISI
+    byte version;                       // InSimVer from its IS_ISI (packet size encoding)
+    packetMask mask;                    // Packet types forwarded to this client
+    struct packBuffer buf;              // Incomplete packet data
+};
+
+/**
+* CInsimMux class to share one Insim connection between several local programs
+*/
+class CInsimMux
+{
+  private:
+    CInsim* upstream;
+    std::string path;
+    int listenfd;
+    byte buttons;                               // ClickIDs per client
+    int slots;                                  // Clients accepted: min(IS_MUX_MAX_CLIENTS, IS_MUX_BUTTONS / buttons)
+    struct muxClient clients[IS_MUX_MAX_CLIENTS];
+    std::map<std::string, packetMask> subscriptions;   // Overrides by client name
+
+    struct { int client; unsigned gen; byte reqi; } reqmap[256];   // Upstream ReqI -> client ReqI
+    byte next_reqi;
+
+    std::chrono::steady_clock::time_point retry_at;    // Next upstream reconnection attempt
+
+    void accept_client();
+    void drop_client(int c);
+    int read_client(int c);
+    void from_client(int c, char* pack, unsigned size);
+    void from_upstream(void* pack, bool udp);
+    int send_client(int c, const char* pack, unsigned size);
+    void upstream_lost();
+
+  public:
+    /**
+     * @param CInsim* Upstream connection. Must not be read by anything else while the mux runs
+     * @param std::string Path of the UNIX socket the clients connect to
+     * @param byte Button ClickIDs reserved for each client. Limits the clients to 240 / buttonsPerClient
+     */
+    CInsimMux(CInsim* upstream, const std::string path, byte buttonsPerClient = 40);
+    ~CInsimMux();
+
+    CInsimMux(const CInsimMux&) = delete;
+    CInsimMux& operator=(const CInsimMux&) = delete;
+
+    int listen();                       // Creates the UNIX socket
+    void close();                       // Disconnects every client and removes the socket
+
+    int poll(int timeout_ms);           // Services upstream and clients. Number of upstream packets, -1 on error
+
+    void setSubscription(const std::string name, const packetMask mask);   // Packet types for clients called "name"
+    int clientCount();
+};
+
+#endif // CIS_LINUX
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimNodes
+ * ===========
+ *
+ * Live intervals from the path nodes. See CInsimNodes.h
+ */
+
+#include <CInsimNodes.h>
+
+CInsimNodes::CInsimNodes()
+{
+    numNodes = 0;
+    finish = 0;
+    clear();
+}
+
+void CInsimNodes::clear()
+{
+    std::fill(stamps.begin(), stamps.end(), nodeStamp{0, 0});
+    memset(last, 0, sizeof(last));
+    memset(lastTime, 0, sizeof(lastTime));
+    memset(position, 0, sizeof(position));
+    memset(byPosition, 0, sizeof(byPosition));
+    base = std::chrono::steady_clock::now();
+}
+
+struct CInsimNodes::nodeStamp* CInsimNodes::stamp(byte PLID, unsigned progress)
+{
+    return &stamps[PLID * numNodes + (progress - 1) % numNodes];
+}
+
+void CInsimNodes::car(byte PLID, word node, word lap, byte pos, unsigned now)
+{
+    if (pos)
+    {
+        position[PLID] = pos;
+        byPosition[pos] = PLID;
+    }
+
+    if (node >= numNodes)
+        return;
+
+    unsigned p = lap * numNodes + (node + numNodes - finish) % numNodes + 1;
+    unsigned prev = last[PLID];
+
+    // Driving backwards, or the lap not counted yet at the finish line: wait until the car is past its furthest point
+    if (p <= prev)
+        return;
+
+    if (prev && p - prev <= numNodes / 2)
+    {
+        // The nodes crossed since the last update, evenly spread over the time between both
+        unsigned span = p - prev;
+        unsigned dt = now - lastTime[PLID];
+
+        for (unsigned q = 1; q <= span; q++)
+        {
+            struct nodeStamp* s = stamp(PLID, prev + q);
+            s->progress = prev + q;
+            s->time = lastTime[PLID] + (unsigned)((unsigned long long)dt * q / span);
+        }
+    }
+    else
+    {
+        // First sight of the car, or too far from the last one to tell where it went
+        struct nodeStamp* s = stamp(PLID, p);
+        s->progress = p;
+        s->time = now;
+    }
+
+    last[PLID] = p;
+    lastTime[PLID] = now;
+}
+
+void CInsimNodes::update(void* packet)
+{
+    unsigned now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - base).count();
+
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_RST:
+        {
+            struct IS_RST* rst = (struct IS_RST*)packet;
+            bool moved = rst->NumNodes != numNodes || rst->Finish != finish;
+
+            if (rst->NumNodes != numNodes)
+            {
+                numNodes = rst->NumNodes;
+                stamps.assign(256 * numNodes, nodeStamp{0, 0});
+            }
+
+            finish = rst->Finish;
+
+            // A reply to TINY_RST describes the race already going on: the stamps stay valid on the same path
+            if (rst->ReqI == 0 || moved)
+                clear();
+            break;
+        }
+
+        case ISP_MCI:
+        {
+            struct IS_MCI* mci = (struct IS_MCI*)packet;
+            int numc = mci->NumC > MCI_MAX_CARS ? MCI_MAX_CARS : mci->NumC;
+
+            for (int i = 0; i < numc; i++)
+                car(mci->Info[i].PLID, mci->Info[i].Node, mci->Info[i].Lap, mci->Info[i].Position, now);
+            break;
+        }
+
+        case ISP_NLP:
+        {
+            struct IS_NLP* nlp = (struct IS_NLP*)packet;
+            int nump = nlp->NumP > NLP_MAX_CARS ? NLP_MAX_CARS : nlp->NumP;
+
+            for (int i = 0; i < nump; i++)
+                car(nlp->Info[i].PLID, nlp->Info[i].Node, nlp->Info[i].Lap, nlp->Info[i].Position, now);
+            break;
+        }
+
+        case ISP_PLL:
+        {
+            byte p = ((struct IS_PLL*)packet)->PLID;
+
+            // The PLID may be given to a new player
+            if (numNodes)
+                std::fill(stamps.begin() + p * numNodes, stamps.begin() + (p + 1) * numNodes, nodeStamp{0, 0});
+
+            last[p] = 0;
+            position[p] = 0;
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            break;
+    }
+}
+
+void CInsimNodes::update(const struct mciFrame* frame)
+{
+    unsigned now = std::chrono::duration_cast<std::chrono::milliseconds>(frame->time - base).count();
+
+    for (int i = 0; i < frame->numCars; i++)
+        car(frame->cars[i].PLID, frame->cars[i].Node, frame->cars[i].Lap, frame->cars[i].Position, now);
+}
+
+int CInsimNodes::gap(byte PLID, byte ahead)
+{
+    unsigned p = last[PLID];
+
+    if (!p || !last[ahead])
+        return -1;
+
+    const struct nodeStamp* a = stamp(ahead, p);
+
+    // Not there yet, or there a lap or more ago and overwritten since
+    if (a->progress != p)
+        return -1;
+
+    return stamp(PLID, p)->time - a->time;
+}
+
+int CInsimNodes::interval(byte PLID)
+{
+    byte pos = position[PLID];
+
+    if (pos < 2 || position[byPosition[pos - 1]] != pos - 1)
+        return -1;
+
+    return gap(PLID, byPosition[pos - 1]);
+}
+
+int CInsimNodes::gapToLeader(byte PLID)
+{
+    byte pos = position[PLID];
+
+    if (pos == 1)
+        return 0;
+
+    if (pos == 0 || position[byPosition[1]] != 1)
+        return -1;
+
+    return gap(PLID, byPosition[1]);
+}
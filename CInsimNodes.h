@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimNodes
+ * ===========
+ *
+ * Live intervals from the path nodes. IS_LAP and IS_SPX only time a car at a
+ * few points per lap, but the Node and Lap of every car arrive with each
+ * IS_MCI and IS_NLP. CInsimNodes records the time at which each car reached
+ * each node of the path, so the gap between two cars is the time the car
+ * behind needed to get where the other one was:
+ *
+ *   gap = (when B reached node n) - (when A reached node n)
+ *
+ * where n is the node B is on now. Nodes skipped between two updates get
+ * linearly interpolated times. Each car keeps one stamp per node of the path,
+ * the last lap it drove, allocated once when IS_RST gives the number of
+ * nodes. Nothing is recorded before the first IS_RST (request it with
+ * TINY_RST after connecting).
+ */
+
+#ifndef _CINSIMNODES_H
+#define _CINSIMNODES_H
+
+#include "CInsimFrames.h"
+
+/**
+* CInsimNodes class to measure the gaps between cars at every path node
+*/
+class CInsimNodes
+{
+  private:
+    // When a car reached a node, in the lap given by the tag
+    struct nodeStamp
+    {
+        unsigned progress;              // Lap * NumNodes + nodes from the finish line, +1 (0 = empty)
+        unsigned time;                  // (ms since the last clear)
+    };
+
+    std::vector<struct nodeStamp> stamps;       // NumNodes stamps per PLID
+    unsigned numNodes;
+    unsigned finish;                    // Node of the finish line
+
+    unsigned last[256];                 // Progress of each car at its last update, +1 (0 = not seen)
+    unsigned lastTime[256];
+    byte position[256];                 // Race position of each PLID, 0 if unknown
+    byte byPosition[256];               // PLID at each race position
+
+    std::chrono::steady_clock::time_point base;
+
+    void car(byte PLID, word node, word lap, byte pos, unsigned now);
+    struct nodeStamp* stamp(byte PLID, unsigned progress);
+
+  public:
+    CInsimNodes();
+
+    void clear();                       // Forgets the cars and the times
+    void update(void* packet);          // Applies an IS_RST, IS_MCI, IS_NLP, IS_PLL or TINY_CLR/MPE received now. Other types are ignored
+    void update(const struct mciFrame* frame);     // Same as the IS_MCI packets of the frame, at the time it was received
+
+    /** @brief Gap between two cars
+     *
+     * @param byte PLayer ID of the car behind
+     * @param byte PLayer ID of the car ahead
+     * @return int How long (ms) before the car behind the car ahead reached the node the car behind is on now.
+     * -1 if unknown, e.g. the car ahead is a lap or more ahead, or behind
+     *
+     */
+    int gap(byte PLID, byte ahead);
+    int interval(byte PLID);            // Gap to the car one race position ahead, -1 if unknown or leader
+    int gapToLeader(byte PLID);         // Gap to the race leader, 0 for the leader, -1 if unknown
+
+    unsigned getNumNodes() { return numNodes; }
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimOutGauge
+ * ==============
+ *
+ * OutGauge receiver. See CInsimOutGauge.h
+ */
+
+#include <CInsimOutGauge.h>
+
+#define OG_SIZE_NO_ID (sizeof(struct OutGaugePack) - sizeof(int))
+
+CInsimOutGauge::CInsimOutGauge()
+{
+    for (int i = 0; i < IS_OUTGAUGE_SLOTS; i++)
+    {
+        slots[i].used.store(false);
+        slots[i].id = 0;
+        slots[i].seq.store(0);
+        slots[i].updates = 0;
+        memset(&slots[i].pack, 0, sizeof(slots[i].pack));
+    }
+
+    sock = INVALID_SOCKET;
+    received = 0;
+    rejected = 0;
+}
+
+CInsimOutGauge::~CInsimOutGauge()
+{
+    close();
+}
+
+int CInsimOutGauge::open(word port)
+{
+    #ifdef CIS_WINDOWS
+    WSADATA wsadata;
+    if (WSAStartup(0x202, &wsadata) == SOCKET_ERROR) {
+      WSACleanup();
+      return -1;
+    }
+    #endif
+
+    close();
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sock == INVALID_SOCKET)
+        return -1;
+
+    struct sockaddr_in my_addr;
+    memset(&my_addr, 0, sizeof(my_addr));
+    my_addr.sin_family = AF_INET;
+    my_addr.sin_port = htons(port);
+    my_addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(sock, (struct sockaddr *)&my_addr, sizeof my_addr) < 0)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimOutGauge::open - Could not bind port " << port << std::endl;
+        #endif // IS_DEBUG
+        close();
+        return -1;
+    }
+
+    // poll() reads until the socket is empty
+    #ifdef CIS_WINDOWS
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+    #elif defined CIS_LINUX
+    int fl = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, fl | O_NONBLOCK);
+    #endif
+
+    return 0;
+}
+
+void CInsimOutGauge::close()
+{
+    if (sock == INVALID_SOCKET)
+        return;
+
+    #ifdef CIS_WINDOWS
+    closesocket(sock);
+    WSACleanup();
+    #elif defined CIS_LINUX
+    ::close(sock);
+    #endif
+
+    sock = INVALID_SOCKET;
+}
+
+void CInsimOutGauge::setCallback(outGaugeFunc func)
+{
+    on_pack = func;
+}
+
+/**
+* Slot of an OutGauge ID. Only the receiving thread adds slots
+*/
+struct CInsimOutGauge::ogSlot* CInsimOutGauge::slot(int id, bool add)
+{
+    for (int i = 0; i < IS_OUTGAUGE_SLOTS; i++)
+    {
+        if (!slots[i].used.load(std::memory_order_acquire))
+        {
+            if (!add)
+                return nullptr;
+
+            slots[i].id = id;
+            slots[i].used.store(true, std::memory_order_release);
+            return &slots[i];
+        }
+
+        if (slots[i].id == id)
+            return &slots[i];
+    }
+
+    return nullptr;
+}
+
+int CInsimOutGauge::feed(const void* data, int bytes)
+{
+    if (bytes != (int)sizeof(struct OutGaugePack) && bytes != (int)OG_SIZE_NO_ID)
+        return 0;
+
+    int id = 0;
+    if (bytes == (int)sizeof(struct OutGaugePack))
+        memcpy(&id, (const char*)data + OG_SIZE_NO_ID, sizeof(int));
+
+    struct ogSlot* s = slot(id, true);
+    if (!s)
+        return 0;
+
+    // Readers never hold us up: they retry if they overlap this write
+    unsigned seq = s->seq.load(std::memory_order_relaxed);
+    s->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&s->pack, data, bytes);
+    s->pack.ID = id;
+    s->updates++;
+
+    s->seq.store(seq + 2, std::memory_order_release);
+
+    if (on_pack)
+        on_pack(&s->pack);
+
+    return 1;
+}
+
+/**
+* Read one datagram and store it
+* Returns 1 if stored, 2 if rejected, 0 if none was waiting or -1 on error
+*/
+int CInsimOutGauge::receive()
+{
+    int retval = recv(sock, buffer, PACKET_BUFFER_SIZE, 0);
+
+    if (retval < 0)
+    {
+        #ifdef CIS_WINDOWS
+        return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+        #elif defined CIS_LINUX
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        #endif
+    }
+
+    received++;
+
+    if (!feed(buffer, retval))
+    {
+        rejected++;
+        return 2;
+    }
+
+    return 1;
+}
+
+int CInsimOutGauge::poll()
+{
+    int count = 0;
+    int rc;
+
+    while ((rc = receive()) > 0)
+    {
+        if (rc == 1)
+            count++;
+    }
+
+    return rc < 0 ? -1 : count;
+}
+
+int CInsimOutGauge::latest(int id, struct OutGaugePack* out, unsigned* updates)
+{
+    struct ogSlot* s = slot(id, false);
+
+    if (!s)
+        return 0;
+
+    for (int i = 0; i < IS_OUTGAUGE_RETRIES; i++)
+    {
+        unsigned seq = s->seq.load(std::memory_order_acquire);
+
+        if (seq & 1)                    // The receiving thread is writing
+            continue;
+
+        memcpy(out, &s->pack, sizeof(struct OutGaugePack));
+        unsigned n = s->updates;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (s->seq.load(std::memory_order_relaxed) == seq)
+        {
+            if (updates)
+                *updates = n;
+            return n ? 1 : 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimOutGauge
+ * ==============
+ *
+ * OutGauge receiver. Datagrams are checked against the size of OutGaugePack,
+ * with or without the optional ID, and the last one of each OutGauge ID is
+ * kept in a slot guarded by a seqlock: the receiving thread never waits, and
+ * any other thread takes a consistent copy of the latest dashboard with
+ * latest(), retrying if it overlapped a write.
+ *
+ * The receiver owns a UDP socket. poll() reads every waiting datagram
+ * without blocking and calls the callback for each, and a CInsimManager can
+ * service it from the same loop as the InSim connections (see
+ * CInsimManager::addOutGauge()).
+ */
+
+#ifndef _CINSIMOUTGAUGE_H
+#define _CINSIMOUTGAUGE_H
+
+#include "CInsim.h"
+
+#define IS_OUTGAUGE_SLOTS 8             // Different OutGauge IDs kept at the same time
+#define IS_OUTGAUGE_RETRIES 64          // Attempts of latest() before giving up
+
+/**
+* CInsimOutGauge class to receive OutGauge datagrams
+*/
+class CInsimOutGauge
+{
+  public:
+    // Called on the receiving thread for each valid datagram. ID is 0 if the datagram had none
+    typedef std::function<void (const struct OutGaugePack* pack)> outGaugeFunc;
+
+  private:
+    struct ogSlot
+    {
+        std::atomic<bool> used;         // Set once, after id
+        int id;
+        std::atomic<unsigned> seq;      // Seqlock: odd while the receiving thread is writing
+        unsigned updates;               // Datagrams received for this ID
+        struct OutGaugePack pack;
+        char pad[64];                   // Slots written at the same time don't share a cache line
+    };
+
+    struct ogSlot slots[IS_OUTGAUGE_SLOTS];
+
+    #ifdef CIS_WINDOWS
+    SOCKET sock;
+    #elif defined CIS_LINUX
+    int sock;
+    #endif
+
+    char buffer[PACKET_BUFFER_SIZE];
+    outGaugeFunc on_pack;
+    unsigned long long received, rejected;
+
+    struct ogSlot* slot(int id, bool add);
+    int receive();
+
+  public:
+    CInsimOutGauge();
+    ~CInsimOutGauge();
+
+    CInsimOutGauge(const CInsimOutGauge&) = delete;
+    CInsimOutGauge& operator=(const CInsimOutGauge&) = delete;
+
+    int open(word port);                // Binds the UDP socket on every interface. Returns 0, or -1 on error
+    void close();
+
+    #ifdef CIS_WINDOWS
+    SOCKET getSocket() { return sock; }
+    #elif defined CIS_LINUX
+    int getSocket() { return sock; }
+    #endif
+
+    /** @brief Store a datagram received elsewhere (e.g. on the InSim UDP port after SMALL_SSG)
+     *
+     * @param void* Datagram
+     * @param int Its size
+     * @return int 1 if stored, 0 if the size is wrong or every slot is taken by other IDs
+     *
+     */
+    int feed(const void* data, int bytes);
+
+    int poll();                         // Stores every datagram waiting, calling the callback for each. Returns how many, -1 on error
+    void setCallback(outGaugeFunc func);
+
+    /** @brief Copy of the latest dashboard of an OutGauge ID (any thread)
+     *
+     * @param int OutGauge ID, 0 if LFS sends none
+     * @param OutGaugePack* Output
+     * @param unsigned* Datagrams received for this ID so far, to tell if it is new (can be NULL)
+     * @return int 1, 0 if nothing was received for this ID, -1 if it kept changing while being copied
+     *
+     */
+    int latest(int id, struct OutGaugePack* out, unsigned* updates = NULL);
+
+    unsigned long long getReceived() { return received; }
+    unsigned long long getRejected() { return rejected; }         // Wrong size, or no free slot
+};
+
+#endif
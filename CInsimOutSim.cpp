@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimOutSim
+ * ============
+ *
+ * OutSim receiver. See CInsimOutSim.h
+ */
+
+#include <CInsimOutSim.h>
+
+#include <cstddef>
+
+CInsimOutSim::CInsimOutSim(unsigned opts)
+{
+    if (opts == 0 || opts > 0xFF) {
+        throw new std::logic_error("CInsimOutSim: OutSim Opts must be between 1 and ff");
+    }
+
+    // Size and place in OutSimPack2 of each block, in datagram order
+    static const int blocks[OSO_BLOCKS][2] =
+    {
+        { offsetof(OutSimPack2, L), 4 },                                // OSO_HEADER
+        { offsetof(OutSimPack2, ID), 4 },                               // OSO_ID
+        { offsetof(OutSimPack2, Time), 4 },                             // OSO_TIME
+        { offsetof(OutSimPack2, OSMain), sizeof(OutSimMain) },          // OSO_MAIN
+        { offsetof(OutSimPack2, OSInputs), sizeof(OutSimInputs) },      // OSO_INPUTS
+        { offsetof(OutSimPack2, Gear), 12 },                            // OSO_DRIVE
+        { offsetof(OutSimPack2, CurrentLapDist), 8 },                   // OSO_DISTANCE
+        { offsetof(OutSimPack2, OSWheels), 4 * sizeof(OutSimWheel) },   // OSO_WHEELS
+    };
+
+    this->opts = opts;
+    copyCount = 0;
+    size = 0;
+
+    for (int i = 0; i < OSO_BLOCKS; i++)
+    {
+        if (!(opts & (1 << i)))
+            continue;
+
+        struct osoCopy* last = copyCount ? &copies[copyCount - 1] : nullptr;
+
+        // Blocks that follow each other in both layouts are copied at once
+        if (last && last->src + last->len == size && last->dst + last->len == blocks[i][0])
+            last->len += blocks[i][1];
+        else
+        {
+            copies[copyCount].src = size;
+            copies[copyCount].dst = blocks[i][0];
+            copies[copyCount].len = blocks[i][1];
+            copyCount++;
+        }
+
+        size += blocks[i][1];
+    }
+
+    memset(&pack, 0, sizeof(pack));
+    sock = INVALID_SOCKET;
+    received = 0;
+    rejected = 0;
+}
+
+CInsimOutSim::~CInsimOutSim()
+{
+    close();
+}
+
+int CInsimOutSim::open(word port)
+{
+    #ifdef CIS_WINDOWS
+    WSADATA wsadata;
+    if (WSAStartup(0x202, &wsadata) == SOCKET_ERROR) {
+      WSACleanup();
+      return -1;
+    }
+    #endif
+
+    close();
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sock == INVALID_SOCKET)
+        return -1;
+
+    struct sockaddr_in my_addr;
+    memset(&my_addr, 0, sizeof(my_addr));
+    my_addr.sin_family = AF_INET;
+    my_addr.sin_port = htons(port);
+    my_addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(sock, (struct sockaddr *)&my_addr, sizeof my_addr) < 0)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimOutSim::open - Could not bind port " << port << std::endl;
+        #endif // IS_DEBUG
+        close();
+        return -1;
+    }
+
+    // poll() reads until the socket is empty
+    #ifdef CIS_WINDOWS
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+    #elif defined CIS_LINUX
+    int fl = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, fl | O_NONBLOCK);
+    #endif
+
+    return 0;
+}
+
+void CInsimOutSim::close()
+{
+    if (sock == INVALID_SOCKET)
+        return;
+
+    #ifdef CIS_WINDOWS
+    closesocket(sock);
+    WSACleanup();
+    #elif defined CIS_LINUX
+    ::close(sock);
+    #endif
+
+    sock = INVALID_SOCKET;
+}
+
+void CInsimOutSim::setCallback(outSimFunc func)
+{
+    on_pack = func;
+}
+
+int CInsimOutSim::decode(const void* data, int bytes, struct OutSimPack2* out)
+{
+    if (bytes != size)
+        return -1;
+
+    for (int i = 0; i < copyCount; i++)
+        memcpy((char*)out + copies[i].dst, (const char*)data + copies[i].src, copies[i].len);
+
+    return 0;
+}
+
+/**
+* Read one datagram into "pack"
+* Returns 1 if decoded, 2 if rejected, 0 if none was waiting or -1 on error
+*/
+int CInsimOutSim::receive()
+{
+    int retval = recv(sock, buffer, PACKET_BUFFER_SIZE, 0);
+
+    if (retval < 0)
+    {
+        #ifdef CIS_WINDOWS
+        return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+        #elif defined CIS_LINUX
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        #endif
+    }
+
+    received++;
+
+    if (decode(buffer, retval, &pack) < 0)
+    {
+        rejected++;
+        return 2;
+    }
+
+    return 1;
+}
+
+int CInsimOutSim::recv_packet()
+{
+    int rc = receive();
+    return rc == 2 ? 0 : rc;
+}
+
+int CInsimOutSim::poll()
+{
+    int count = 0;
+    int rc;
+
+    while ((rc = receive()) > 0)
+    {
+        if (rc == 2)
+            continue;
+
+        if (on_pack)
+            on_pack(&pack);
+        count++;
+    }
+
+    return rc < 0 ? -1 : count;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimOutSim
+ * ============
+ *
+ * OutSim receiver. The layout of an OutSimPack2 datagram depends on the
+ * "OutSim Opts" of cfg.txt (OSO_ bits, see OutSimPack.h): blocks that are
+ * not selected are left out and the following ones move up. The receiver
+ * is built with the same options and works out once where each selected
+ * block lies in the datagram and in OutSimPack2. Decoding a datagram is then
+ * a size check and a few block copies into a full OutSimPack2, with the
+ * fields not selected left at zero.
+ *
+ * The receiver owns a UDP socket that can be watched from an external event
+ * loop (getSocket()), and poll() reads every waiting datagram without
+ * blocking, so one thread can serve several sim rigs at 100 Hz. Datagrams
+ * arriving through another socket (e.g. the InSim UDP port, after an
+ * IS_SMALL SMALL_SSP) can be given to decode().
+ */
+
+#ifndef _CINSIMOUTSIM_H
+#define _CINSIMOUTSIM_H
+
+#include "CInsim.h"
+#include "OutSimPack.h"
+
+#define OSO_BLOCKS 8                    // OSO_HEADER to OSO_WHEELS
+
+/**
+* CInsimOutSim class to receive and decode OutSim datagrams
+*/
+class CInsimOutSim
+{
+  public:
+    // Called by poll() for each datagram decoded
+    typedef std::function<void (const struct OutSimPack2* pack)> outSimFunc;
+
+  private:
+    // Copy of one run of selected blocks
+    struct osoCopy
+    {
+        int src;                        // Offset in the datagram
+        int dst;                        // Offset in OutSimPack2
+        int len;
+    };
+
+    unsigned opts;
+    struct osoCopy copies[OSO_BLOCKS];
+    int copyCount;
+    int size;                           // Size of the datagrams with these options
+
+    #ifdef CIS_WINDOWS
+    SOCKET sock;
+    #elif defined CIS_LINUX
+    int sock;
+    #endif
+
+    char buffer[PACKET_BUFFER_SIZE];
+    struct OutSimPack2 pack;            // Last decoded
+    outSimFunc on_pack;
+
+    unsigned long long received, rejected;
+
+    int receive();
+
+  public:
+    CInsimOutSim(unsigned opts);
+    ~CInsimOutSim();
+
+    CInsimOutSim(const CInsimOutSim&) = delete;
+    CInsimOutSim& operator=(const CInsimOutSim&) = delete;
+
+    int open(word port);                // Binds the UDP socket on every interface. Returns 0, or -1 on error
+    void close();
+
+    #ifdef CIS_WINDOWS
+    SOCKET getSocket() { return sock; }
+    #elif defined CIS_LINUX
+    int getSocket() { return sock; }
+    #endif
+
+    unsigned getOpts() { return opts; }
+    int getSize() { return size; }      // Bytes expected per datagram
+
+    /** @brief Decode a datagram
+     *
+     * @param void* Datagram
+     * @param int Its size
+     * @param OutSimPack2* Output. Fields not selected by the options are not written
+     * @return int 0, or -1 if the size doesn't match the options
+     *
+     */
+    int decode(const void* data, int bytes, struct OutSimPack2* out);
+
+    int recv_packet();                  // Reads one datagram. 1 if decoded, 0 if none waiting or rejected, -1 on error
+    const struct OutSimPack2* get_packet() { return &pack; }       // Last datagram decoded by recv_packet() or poll()
+    int poll();                         // Decodes every datagram waiting, calling the callback for each. Returns how many, -1 on error
+    void setCallback(outSimFunc func);
+
+    unsigned long long getReceived() { return received; }
+    unsigned long long getRejected() { return rejected; }         // Wrong size for the options
+};
+
+#endif
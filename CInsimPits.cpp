@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimPits
+ * ==========
+ *
+ * Pit stop and stint records. See CInsimPits.h
+ */
+
+#include <CInsimPits.h>
+
+CInsimPits::CInsimPits()
+{
+    clear();
+}
+
+void CInsimPits::clear()
+{
+    memset(active, 0, sizeof(active));
+    stopCount = 0;
+    stintCount = 0;
+    dropped = 0;
+    base = std::chrono::steady_clock::now();
+}
+
+unsigned CInsimPits::ms(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t - base).count();
+}
+
+void CInsimPits::join(byte PLID, const byte* tyres, unsigned now)
+{
+    struct pitPlayer* p = &players[PLID];
+
+    memset(p, 0, sizeof(struct pitPlayer));
+    p->PLID = PLID;
+    p->firstStop = p->lastStop = -1;
+    p->firstStint = p->lastStint = -1;
+    memcpy(p->tyres, tyres, 4);
+    active[PLID] = true;
+
+    start_stint(PLID, now);
+}
+
+void CInsimPits::start_stint(byte PLID, unsigned now)
+{
+    struct pitPlayer* p = &players[PLID];
+
+    if (stintCount == IS_PITS_POOL)
+    {
+        dropped++;
+        return;
+    }
+
+    int i = stintCount++;
+    struct pitStint* s = &stintPool[i];
+
+    s->PLID = PLID;
+    s->startLap = p->lapsDone;
+    s->laps = 0;
+    s->startTime = now;
+    s->duration = 0;
+    memcpy(s->tyres, p->tyres, 4);
+    s->next = -1;
+
+    if (p->lastStint >= 0)
+        stintPool[p->lastStint].next = i;
+    else
+        p->firstStint = i;
+    p->lastStint = i;
+}
+
+void CInsimPits::end_stint(byte PLID, unsigned now)
+{
+    struct pitPlayer* p = &players[PLID];
+
+    if (p->lastStint < 0)
+        return;
+
+    struct pitStint* s = &stintPool[p->lastStint];
+    if (s->duration == 0)
+    {
+        s->laps = p->lapsDone - s->startLap;
+        s->duration = now > s->startTime ? now - s->startTime : 1;
+    }
+}
+
+// true if the last stint was ended (IS_PLP, IS_PLA), or was dropped
+bool CInsimPits::stint_closed(byte PLID)
+{
+    int i = players[PLID].lastStint;
+
+    return i < 0 || stintPool[i].duration != 0;
+}
+
+struct pitStop* CInsimPits::open_stop(byte PLID, byte fact, unsigned now)
+{
+    struct pitPlayer* p = &players[PLID];
+
+    p->inLane = true;
+    p->stops++;
+
+    if (stopCount == IS_PITS_POOL)
+    {
+        dropped++;
+        return nullptr;
+    }
+
+    int i = stopCount++;
+    struct pitStop* s = &stopPool[i];
+
+    memset(s, 0, sizeof(struct pitStop));
+    s->PLID = PLID;
+    s->fact = fact;
+    s->lap = p->lapsDone;
+    s->enterTime = now;
+    memset(s->tyres, NOT_CHANGED, 4);
+    s->fuelAdd = 255;
+    s->next = -1;
+
+    if (p->lastStop >= 0)
+        stopPool[p->lastStop].next = i;
+    else
+        p->firstStop = i;
+    p->lastStop = i;
+
+    return s;
+}
+
+// The stop of a car in the pit lane, nullptr if it was dropped
+struct pitStop* CInsimPits::current_stop(byte PLID)
+{
+    int i = players[PLID].lastStop;
+
+    return i >= 0 && stopPool[i].laneTime == 0 ? &stopPool[i] : nullptr;
+}
+
+void CInsimPits::update(void* packet)
+{
+    update(packet, std::chrono::steady_clock::now());
+}
+
+void CInsimPits::update(void* packet, std::chrono::steady_clock::time_point t)
+{
+    unsigned now = ms(t);
+
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_RST:
+        {
+            // A reply to TINY_RST describes the race already going on
+            if (((struct IS_RST*)packet)->ReqI != 0)
+                break;
+
+            stopCount = 0;
+            stintCount = 0;
+            dropped = 0;
+            base = t;
+
+            for (int i = 1; i < 256; i++)
+            {
+                if (active[i])
+                    join(i, players[i].tyres, 0);
+            }
+            break;
+        }
+
+        case ISP_NPL:
+        {
+            struct IS_NPL* npl = (struct IS_NPL*)packet;
+
+            if (npl->NumP == 0)
+                break;
+
+            if (!active[npl->PLID])
+                join(npl->PLID, npl->Tyres, now);
+            else if (npl->ReqI == 0 && stint_closed(npl->PLID))
+            {
+                // Back from the garage (IS_PLP), maybe on other tyres. A reply to TINY_NPL
+                // or a repeated IS_NPL doesn't start a stint
+                memcpy(players[npl->PLID].tyres, npl->Tyres, 4);
+                start_stint(npl->PLID, now);
+            }
+            break;
+        }
+
+        case ISP_PLP:
+        {
+            byte p = ((struct IS_PLP*)packet)->PLID;
+            if (active[p])
+                end_stint(p, now);
+            break;
+        }
+
+        case ISP_PLL:
+        {
+            byte p = ((struct IS_PLL*)packet)->PLID;
+            if (active[p])
+            {
+                end_stint(p, now);
+                active[p] = false;
+            }
+            break;
+        }
+
+        case ISP_LAP:
+        {
+            struct IS_LAP* lap = (struct IS_LAP*)packet;
+            if (active[lap->PLID])
+                players[lap->PLID].lapsDone = lap->LapsDone;
+            break;
+        }
+
+        case ISP_PLA:
+        {
+            struct IS_PLA* pla = (struct IS_PLA*)packet;
+            struct pitPlayer* p = &players[pla->PLID];
+
+            if (!active[pla->PLID])
+                break;
+
+            if (pla->Fact != PITLANE_EXIT)
+            {
+                if (!p->inLane)
+                {
+                    end_stint(pla->PLID, now);
+                    open_stop(pla->PLID, pla->Fact, now);
+                }
+                else if (current_stop(pla->PLID))
+                    current_stop(pla->PLID)->fact = pla->Fact;
+                break;
+            }
+
+            if (!p->inLane)
+                break;
+
+            struct pitStop* s = current_stop(pla->PLID);
+            if (s)
+            {
+                s->laneTime = now > s->enterTime ? now - s->enterTime : 1;
+                p->laneTotal += s->laneTime;
+            }
+
+            p->inLane = false;
+            start_stint(pla->PLID, now);
+            break;
+        }
+
+        case ISP_PIT:
+        {
+            struct IS_PIT* pit = (struct IS_PIT*)packet;
+            struct pitPlayer* p = &players[pit->PLID];
+
+            if (!active[pit->PLID])
+                break;
+
+            // IS_PLA may be missing, e.g. connected after the car entered the pit lane
+            if (!p->inLane)
+            {
+                end_stint(pit->PLID, now);
+                open_stop(pit->PLID, PITLANE_ENTER, now);
+            }
+
+            for (int i = 0; i < 4; i++)
+            {
+                if (pit->Tyres[i] != NOT_CHANGED)
+                    p->tyres[i] = pit->Tyres[i];
+            }
+
+            p->lapsDone = pit->LapsDone;
+
+            struct pitStop* s = current_stop(pit->PLID);
+            if (s)
+            {
+                memcpy(s->tyres, pit->Tyres, 4);
+                s->work = pit->Work;
+                s->fuelAdd = pit->FuelAdd;
+                s->penalty = pit->Penalty;
+            }
+            break;
+        }
+
+        case ISP_PSF:
+        {
+            struct IS_PSF* psf = (struct IS_PSF*)packet;
+            struct pitStop* s = active[psf->PLID] ? current_stop(psf->PLID) : nullptr;
+
+            if (active[psf->PLID])
+                players[psf->PLID].stopTotal += psf->STime;
+
+            if (s)
+                s->stopTime = psf->STime;
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            break;
+    }
+}
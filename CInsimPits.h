@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimPits
+ * ==========
+ *
+ * Live pit stop statistics from IS_PLA, IS_PIT and IS_PSF. Every visit to
+ * the pit lane becomes a stop record (time in the lane, time stationary,
+ * tyres, work done, fuel added) and the driving between two visits a stint
+ * record (laps, time, tyres fitted). The lane time is measured between the
+ * IS_PLA that enter and leave the pit lane, at the time they are received
+ * (or the time given to update()).
+ *
+ * Records live in two fixed pools of IS_PITS_POOL entries allocated with the
+ * object, chained per player, so nothing is allocated during a race. When a
+ * pool is full new records are dropped and counted. An IS_RST that isn't a
+ * reply to TINY_RST empties both pools.
+ */
+
+#ifndef _CINSIMPITS_H
+#define _CINSIMPITS_H
+
+#include "CInsim.h"
+
+#include <chrono>
+
+#define IS_PITS_POOL 4096               // Stop records, and stint records
+
+// A visit to the pit lane
+struct pitStop
+{
+    byte        PLID;
+    byte        fact;                   // PITLANE_ reason of the entry (PITLANE_ENTER, PITLANE_DT...)
+    word        lap;                    // Laps done when the car entered
+    unsigned    enterTime;              // (ms since the race start)
+    unsigned    laneTime;               // Time in the pit lane (ms), 0 while still in it
+    unsigned    stopTime;               // Time stationary (ms, from IS_PSF), 0 if the car didn't stop
+    byte        tyres[4];               // Compounds fitted, NOT_CHANGED if not
+    unsigned    work;                   // PSE_ bits, 0 if the car didn't stop
+    byte        fuelAdd;                // Percent, 255 if unknown (/showfuel no)
+    byte        penalty;                // PENALTY_ value when the car stopped
+    int         next;                   // Next stop of the same player, -1 if last
+};
+
+// Driving between two pit lane visits
+struct pitStint
+{
+    byte        PLID;
+    word        startLap;               // Laps done when the stint started
+    word        laps;                   // Laps completed in the stint
+    unsigned    startTime;              // (ms since the race start)
+    unsigned    duration;               // (ms), 0 while running
+    byte        tyres[4];               // Compounds at the start
+    int         next;                   // Next stint of the same player, -1 if last
+};
+
+// Totals of a player
+struct pitPlayer
+{
+    byte        PLID;
+    bool        inLane;                 // In the pit lane now
+    word        lapsDone;
+    byte        tyres[4];               // Compounds fitted now
+    int         stops;                  // Pit lane visits
+    unsigned    laneTotal;              // (ms)
+    unsigned    stopTotal;              // (ms)
+    int         firstStop, lastStop;    // Indexes for getStop(), -1 if none
+    int         firstStint, lastStint;  // Indexes for getStint(), -1 if none
+};
+
+/**
+* CInsimPits class to record the pit stops and stints of every player
+*/
+class CInsimPits
+{
+  private:
+    struct pitStop stopPool[IS_PITS_POOL];
+    struct pitStint stintPool[IS_PITS_POOL];
+    int stopCount, stintCount;
+    int dropped;
+
+    struct pitPlayer players[256];      // Indexed by PLID
+    bool active[256];
+
+    std::chrono::steady_clock::time_point base;
+
+    unsigned ms(std::chrono::steady_clock::time_point t);
+    void join(byte PLID, const byte* tyres, unsigned now);
+    void start_stint(byte PLID, unsigned now);
+    void end_stint(byte PLID, unsigned now);
+    bool stint_closed(byte PLID);
+    struct pitStop* open_stop(byte PLID, byte fact, unsigned now);
+    struct pitStop* current_stop(byte PLID);
+
+  public:
+    CInsimPits();
+
+    void clear();                       // Forgets every player and record
+    void update(void* packet);          // Applies a packet received now
+    void update(void* packet, std::chrono::steady_clock::time_point t);  // IS_RST, IS_NPL, IS_PLP, IS_PLL, IS_LAP, IS_PLA, IS_PIT, IS_PSF or TINY_CLR/MPE. Other types are ignored
+
+    const struct pitPlayer* getPlayer(byte PLID) { return active[PLID] ? &players[PLID] : nullptr; }
+    const struct pitStop* getStop(int index) { return index >= 0 && index < stopCount ? &stopPool[index] : nullptr; }
+    const struct pitStint* getStint(int index) { return index >= 0 && index < stintCount ? &stintPool[index] : nullptr; }
+
+    int stopCountTotal() { return stopCount; }
+    int stintCountTotal() { return stintCount; }
+    int droppedCount() { return dropped; }  // Records lost to full pools since the race start
+};
+
+#endif
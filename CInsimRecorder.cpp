@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimRecorder
+ * ==============
+ *
+ * Columnar recording of OutSim telemetry in a memory mapped file. See CInsimRecorder.h
+ */
+
+#include <CInsimRecorder.h>
+
+#ifdef CIS_LINUX
+
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    // A field of OutSimPack2 recorded as a channel
+    struct recField
+    {
+        const char* name;
+        byte type;
+        byte size;
+        int offset;
+    };
+
+    #define REC_FIELD(n, t, f) { n, t, sizeof(((struct OutSimPack2*)0)->f), (int)offsetof(struct OutSimPack2, f) }
+
+    const struct recField mainFields[] =
+    {
+        REC_FIELD("AngVel.x", REC_FLOAT, OSMain.AngVel.x),
+        REC_FIELD("AngVel.y", REC_FLOAT, OSMain.AngVel.y),
+        REC_FIELD("AngVel.z", REC_FLOAT, OSMain.AngVel.z),
+        REC_FIELD("Heading", REC_FLOAT, OSMain.Heading),
+        REC_FIELD("Pitch", REC_FLOAT, OSMain.Pitch),
+        REC_FIELD("Roll", REC_FLOAT, OSMain.Roll),
+        REC_FIELD("Accel.x", REC_FLOAT, OSMain.Accel.x),
+        REC_FIELD("Accel.y", REC_FLOAT, OSMain.Accel.y),
+        REC_FIELD("Accel.z", REC_FLOAT, OSMain.Accel.z),
+        REC_FIELD("Vel.x", REC_FLOAT, OSMain.Vel.x),
+        REC_FIELD("Vel.y", REC_FLOAT, OSMain.Vel.y),
+        REC_FIELD("Vel.z", REC_FLOAT, OSMain.Vel.z),
+        REC_FIELD("Pos.x", REC_INT, OSMain.Pos.x),
+        REC_FIELD("Pos.y", REC_INT, OSMain.Pos.y),
+        REC_FIELD("Pos.z", REC_INT, OSMain.Pos.z),
+    };
+
+    const struct recField inputFields[] =
+    {
+        REC_FIELD("Throttle", REC_FLOAT, OSInputs.Throttle),
+        REC_FIELD("Brake", REC_FLOAT, OSInputs.Brake),
+        REC_FIELD("InputSteer", REC_FLOAT, OSInputs.InputSteer),
+        REC_FIELD("Clutch", REC_FLOAT, OSInputs.Clutch),
+        REC_FIELD("Handbrake", REC_FLOAT, OSInputs.Handbrake),
+    };
+
+    const struct recField driveFields[] =
+    {
+        REC_FIELD("Gear", REC_BYTE, Gear),
+        REC_FIELD("EngineAngVel", REC_FLOAT, EngineAngVel),
+        REC_FIELD("MaxTorqueAtVel", REC_FLOAT, MaxTorqueAtVel),
+    };
+
+    const struct recField distanceFields[] =
+    {
+        REC_FIELD("CurrentLapDist", REC_FLOAT, CurrentLapDist),
+        REC_FIELD("IndexedDistance", REC_FLOAT, IndexedDistance),
+    };
+
+    // Offsets from the wheel
+    #define REC_WHEEL(n, t, f) { n, t, sizeof(((OutSimWheel*)0)->f), (int)offsetof(OutSimWheel, f) }
+
+    const struct recField wheelFields[] =
+    {
+        REC_WHEEL("SuspDeflect", REC_FLOAT, SuspDeflect),
+        REC_WHEEL("Steer", REC_FLOAT, Steer),
+        REC_WHEEL("XForce", REC_FLOAT, XForce),
+        REC_WHEEL("YForce", REC_FLOAT, YForce),
+        REC_WHEEL("VerticalLoad", REC_FLOAT, VerticalLoad),
+        REC_WHEEL("AngVel", REC_FLOAT, AngVel),
+        REC_WHEEL("LeanRelToRoad", REC_FLOAT, LeanRelToRoad),
+        REC_WHEEL("AirTemp", REC_BYTE, AirTemp),
+        REC_WHEEL("SlipFraction", REC_BYTE, SlipFraction),
+        REC_WHEEL("Touching", REC_BYTE, Touching),
+        REC_WHEEL("SlipRatio", REC_FLOAT, SlipRatio),
+        REC_WHEEL("TanSlipAngle", REC_FLOAT, TanSlipAngle),
+    };
+
+    #undef REC_FIELD
+    #undef REC_WHEEL
+
+    void add_channel(struct recHeader* header, int* src, const char* name, byte type, byte size, int offset)
+    {
+        struct recChannel* ch = &header->channel[header->channels];
+
+        memcpy(ch->name, name, strnlen(name, IS_REC_NAME - 1));
+        ch->type = type;
+        ch->size = size;
+        src[header->channels++] = offset;
+    }
+
+    template <size_t N> void add_fields(struct recHeader* header, int* src, const struct recField (&fields)[N])
+    {
+        for (size_t i = 0; i < N; i++)
+            add_channel(header, src, fields[i].name, fields[i].type, fields[i].size, fields[i].offset);
+    }
+
+    size_t round_up(size_t bytes, size_t unit)
+    {
+        return (bytes + unit - 1) / unit * unit;
+    }
+}
+
+CInsimRecorder::CInsimRecorder()
+{
+    fd = -1;
+    header = nullptr;
+    block = nullptr;
+    blockIndex = 0;
+    pageSize = sysconf(_SC_PAGESIZE);
+}
+
+CInsimRecorder::~CInsimRecorder()
+{
+    close();
+}
+
+int CInsimRecorder::open(const std::string& path, unsigned opts, unsigned blockSamples)
+{
+    close();
+
+    if (blockSamples == 0)
+        return -1;
+
+    size_t headerBytes = round_up(sizeof(struct recHeader), pageSize);
+
+    fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+
+    if (fd < 0)
+        return -1;
+
+    void* mem = MAP_FAILED;
+
+    if (ftruncate(fd, headerBytes) == 0)
+        mem = mmap(NULL, headerBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mem == MAP_FAILED)
+    {
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    // The new file reads as zeros: only what isn't zero is written
+    header = (struct recHeader*)mem;
+    header->opts = opts & (OSO_TIME | OSO_MAIN | OSO_INPUTS | OSO_DRIVE | OSO_DISTANCE | OSO_WHEELS);
+    header->blockSamples = blockSamples;
+    header->headerBytes = headerBytes;
+
+    if (opts & OSO_TIME)
+        add_channel(header, src, "Time", REC_UNSIGNED, sizeof(unsigned), offsetof(struct OutSimPack2, Time));
+    if (opts & OSO_MAIN)
+        add_fields(header, src, mainFields);
+    if (opts & OSO_INPUTS)
+        add_fields(header, src, inputFields);
+    if (opts & OSO_DRIVE)
+        add_fields(header, src, driveFields);
+    if (opts & OSO_DISTANCE)
+        add_fields(header, src, distanceFields);
+
+    if (opts & OSO_WHEELS)
+    {
+        for (int w = 0; w < 4; w++)
+        {
+            int base = offsetof(struct OutSimPack2, OSWheels) + w * sizeof(OutSimWheel);
+
+            for (size_t i = 0; i < sizeof(wheelFields) / sizeof(wheelFields[0]); i++)
+            {
+                char name[IS_REC_NAME];
+                sprintf(name, "Wheel%d.%s", w, wheelFields[i].name);
+                add_channel(header, src, name, wheelFields[i].type, wheelFields[i].size, base + wheelFields[i].offset);
+            }
+        }
+    }
+
+    // Columns start on a cache line, blocks on a page so they can be mapped on their own
+    size_t offset = 0;
+
+    for (unsigned c = 0; c < header->channels; c++)
+    {
+        header->channel[c].offset = offset;
+        offset = round_up(offset + (size_t)header->channel[c].size * blockSamples, 64);
+    }
+
+    header->blockBytes = round_up(offset, pageSize);
+    header->layout = IS_REC_LAYOUT;
+    header->magic = IS_REC_MAGIC;
+    header->samples.store(0, std::memory_order_release);
+
+    return 0;
+}
+
+void CInsimRecorder::close()
+{
+    if (block)
+        munmap(block, header->blockBytes);
+
+    if (header)
+        munmap(header, header->headerBytes);
+
+    if (fd >= 0)
+        ::close(fd);
+
+    fd = -1;
+    header = nullptr;
+    block = nullptr;
+}
+
+/**
+* Grow the file by one block and map it in place of the previous one
+*/
+int CInsimRecorder::map_block(unsigned long long index)
+{
+    if (block)
+    {
+        munmap(block, header->blockBytes);
+        block = nullptr;
+    }
+
+    off_t offset = header->headerBytes + index * header->blockBytes;
+
+    if (ftruncate(fd, offset + header->blockBytes) < 0)
+        return -1;
+
+    void* mem = mmap(NULL, header->blockBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+
+    if (mem == MAP_FAILED)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimRecorder::map_block - Failed to map block " << index << std::endl;
+        #endif
+        return -1;
+    }
+
+    block = (char*)mem;
+    blockIndex = index;
+    return 0;
+}
+
+int CInsimRecorder::record(const struct OutSimPack2* pack)
+{
+    if (!header)
+        return -1;
+
+    unsigned long long n = header->samples.load(std::memory_order_relaxed);
+    unsigned long long index = n / header->blockSamples;
+    size_t i = n % header->blockSamples;
+
+    if ((!block || index != blockIndex) && map_block(index) < 0)
+        return -1;
+
+    for (unsigned c = 0; c < header->channels; c++)
+    {
+        const struct recChannel* ch = &header->channel[c];
+        memcpy(block + ch->offset + i * ch->size, (const char*)pack + src[c], ch->size);
+    }
+
+    // A reader mapping the file never counts a sample before its values
+    header->samples.store(n + 1, std::memory_order_release);
+    return 0;
+}
+
+CInsimRecording::CInsimRecording()
+{
+    data = nullptr;
+    length = 0;
+    header = nullptr;
+    blocks = 0;
+}
+
+CInsimRecording::~CInsimRecording()
+{
+    close();
+}
+
+int CInsimRecording::open(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct recHeader))
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mem == MAP_FAILED)
+        return -1;
+
+    data = (const char*)mem;
+    length = st.st_size;
+    header = (const struct recHeader*)mem;
+
+    if (header->magic != IS_REC_MAGIC || header->layout != IS_REC_LAYOUT || header->channels > IS_REC_CHANNELS
+        || header->blockSamples == 0 || header->blockBytes == 0 || header->headerBytes > length)
+    {
+        close();
+        return -1;
+    }
+
+    blocks = (length - header->headerBytes) / header->blockBytes;
+    return 0;
+}
+
+void CInsimRecording::close()
+{
+    if (data)
+        munmap((void*)data, length);
+
+    data = nullptr;
+    length = 0;
+    header = nullptr;
+    blocks = 0;
+}
+
+unsigned long long CInsimRecording::getSamples()
+{
+    if (!header)
+        return 0;
+
+    unsigned long long samples = header->samples.load(std::memory_order_acquire);
+    unsigned long long mapped = blocks * header->blockSamples;
+
+    return samples < mapped ? samples : mapped;
+}
+
+const struct recChannel* CInsimRecording::getChannel(int channel)
+{
+    if (!header || channel < 0 || (unsigned)channel >= header->channels)
+        return nullptr;
+
+    return &header->channel[channel];
+}
+
+int CInsimRecording::findChannel(const std::string& name)
+{
+    for (int c = 0; c < channelCount(); c++)
+    {
+        if (name.compare(0, IS_REC_NAME, header->channel[c].name, strnlen(header->channel[c].name, IS_REC_NAME)) == 0)
+            return c;
+    }
+
+    return -1;
+}
+
+const void* CInsimRecording::column(int channel, unsigned long long sample, size_t* count)
+{
+    const struct recChannel* ch = getChannel(channel);
+    unsigned long long samples = getSamples();
+
+    if (!ch || sample >= samples)
+        return nullptr;
+
+    unsigned long long index = sample / header->blockSamples;
+    size_t i = sample % header->blockSamples;
+    size_t end = header->blockSamples;
+
+    if (samples - index * header->blockSamples < end)
+        end = samples - index * header->blockSamples;
+
+    if (count)
+        *count = end - i;
+
+    return data + header->headerBytes + index * header->blockBytes + ch->offset + i * ch->size;
+}
+
+size_t CInsimRecording::read(int channel, unsigned long long from, size_t count, void* out)
+{
+    size_t done = 0;
+
+    while (done < count)
+    {
+        size_t run;
+        const void* values = column(channel, from + done, &run);
+
+        if (!values)
+            break;
+
+        if (run > count - done)
+            run = count - done;
+
+        size_t size = header->channel[channel].size;
+        memcpy((char*)out + done * size, values, run * size);
+        done += run;
+    }
+
+    return done;
+}
+
+#endif // CIS_LINUX
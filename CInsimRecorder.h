@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimRecorder
+ * ==============
+ *
+ * Columnar recording of OutSim telemetry in a memory mapped file (*NIX only).
+ * Every field of the OutSimPack2 blocks selected when the recorder is opened
+ * (OSO_TIME, OSO_MAIN, OSO_INPUTS, OSO_DRIVE, OSO_DISTANCE, OSO_WHEELS) is a
+ * channel, e.g. "Vel.y" or "Wheel2.VerticalLoad", and each channel is stored
+ * as a column of its own:
+ *
+ *   | header | block 0: column 0, column 1, ... | block 1: column 0, ... |
+ *
+ * The header (one page) gives the channels and the number of samples written.
+ * Blocks hold blockSamples samples of every channel, and are added to the end
+ * of the file as the recording grows. Recording a sample is a small memcpy
+ * per channel into the mapped block: no write() and no formatting.
+ *
+ * CInsimRecording maps a recorded file read only. Reading a channel touches
+ * one contiguous column per block and nothing of the other channels, so a
+ * single channel of hours of data is read without going through the rest.
+ */
+
+#ifndef _CINSIMRECORDER_H
+#define _CINSIMRECORDER_H
+
+#include "CInsim.h"
+#include "OutSimPack.h"
+
+#ifdef CIS_LINUX
+
+#include <atomic>
+#include <string>
+
+#define IS_REC_MAGIC 0x43455249         // "IREC"
+#define IS_REC_LAYOUT 1                 // Incremented whenever the file format changes
+#define IS_REC_BLOCK 4096               // Default samples per block (41 s at 100 Hz)
+#define IS_REC_CHANNELS 96              // Maximum number of channels
+#define IS_REC_NAME 24
+
+// Type of the values of a channel
+enum
+{
+    REC_FLOAT,
+    REC_INT,
+    REC_UNSIGNED,
+    REC_BYTE,
+};
+
+// A channel, as described in the header
+struct recChannel
+{
+    char        name[IS_REC_NAME];      // e.g. "Accel.x", "Wheel0.SlipRatio"
+    byte        type;                   // REC_
+    byte        size;                   // Bytes per value
+    word        Sp;
+    unsigned    offset;                 // Of the column in each block
+};
+
+// Start of a recording file
+struct recHeader
+{
+    unsigned    magic;                  // IS_REC_MAGIC
+    unsigned    layout;                 // IS_REC_LAYOUT
+    unsigned    opts;                   // OSO_ blocks recorded
+    unsigned    channels;
+    unsigned    blockSamples;           // Samples per block
+    unsigned    blockBytes;             // Size of a block (whole pages)
+    unsigned    headerBytes;            // Offset of the first block (whole pages)
+    unsigned    Sp;
+    std::atomic<unsigned long long> samples;    // Written completely. Updated after each sample
+    struct recChannel channel[IS_REC_CHANNELS];
+};
+
+/**
+* CInsimRecorder class to record OutSim samples in columns (writer side)
+*/
+class CInsimRecorder
+{
+  private:
+    int fd;
+    struct recHeader* header;
+    char* block;                        // Mapped block being filled, NULL if none
+    unsigned long long blockIndex;
+    size_t pageSize;
+
+    int src[IS_REC_CHANNELS];           // Offset of each channel in OutSimPack2
+
+    int map_block(unsigned long long index);
+
+  public:
+    CInsimRecorder();
+    ~CInsimRecorder();
+
+    CInsimRecorder(const CInsimRecorder&) = delete;
+    CInsimRecorder& operator=(const CInsimRecorder&) = delete;
+
+    /** @brief Create a recording file, replacing any file with the same name
+     *
+     * @param string Path of the file
+     * @param unsigned OSO_ blocks to record. OSO_HEADER and OSO_ID are ignored
+     * @param unsigned Samples per block
+     * @return int 0, or -1 on error
+     *
+     */
+    int open(const std::string& path, unsigned opts, unsigned blockSamples = IS_REC_BLOCK);
+    void close();                       // Unmaps and closes the file. Whole blocks are kept, only getSamples() are valid
+
+    int record(const struct OutSimPack2* pack);     // Appends a sample, e.g. from CInsimOutSim. -1 if not open or the file can't grow
+    unsigned long long getSamples() { return header ? header->samples.load(std::memory_order_relaxed) : 0; }
+};
+
+/**
+* CInsimRecording class to read the channels of a recording file (reader side)
+*/
+class CInsimRecording
+{
+  private:
+    const char* data;
+    size_t length;
+    const struct recHeader* header;
+    unsigned long long blocks;          // Whole blocks mapped
+
+  public:
+    CInsimRecording();
+    ~CInsimRecording();
+
+    CInsimRecording(const CInsimRecording&) = delete;
+    CInsimRecording& operator=(const CInsimRecording&) = delete;
+
+    int open(const std::string& path);  // Maps the file read only. -1 if it can't be read or has another layout
+    void close();
+
+    unsigned long long getSamples();    // Samples that can be read. Samples recorded after open() need another open()
+    unsigned getOpts() { return header ? header->opts : 0; }
+
+    int channelCount() { return header ? header->channels : 0; }
+    const struct recChannel* getChannel(int channel);       // nullptr if out of range
+    int findChannel(const std::string& name);               // -1 if not recorded
+
+    /** @brief Column of a channel in one block, without copying
+     *
+     * @param int Channel
+     * @param unsigned long long Sample
+     * @param size_t* Output. Number of values from the sample to the end of its block
+     * @return const void* First value, nullptr if out of range
+     *
+     */
+    const void* column(int channel, unsigned long long sample, size_t* count);
+
+    /** @brief Copy a range of values of a channel
+     *
+     * @param int Channel
+     * @param unsigned long long First sample
+     * @param size_t Number of samples
+     * @param void* Output, room for count values of the channel size
+     * @return size_t Values copied
+     *
+     */
+    size_t read(int channel, unsigned long long from, size_t count, void* out);
+};
+
+#endif // CIS_LINUX
+
+#endif
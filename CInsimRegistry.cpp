@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimRegistry
+ * ==============
+ *
+ * Built-in tracking of the host state. See CInsimRegistry.h
+ */
+
+#include <CInsimRegistry.h>
+
+CInsimRegistry::CInsimRegistry()
+{
+    clear();
+}
+
+void CInsimRegistry::clear()
+{
+    memset(conns, 0, sizeof(conns));
+    conn_count = 0;
+    clear_players();
+}
+
+void CInsimRegistry::clear_players()
+{
+    memset(players, 0, sizeof(players));
+    player_count = 0;
+
+    for (int i = 0; i < 256; i++)
+        conns[i].firstPLID = 0;
+}
+
+void CInsimRegistry::setConnCallback(connFunc func)
+{
+    on_conn = func;
+}
+
+void CInsimRegistry::setPlayerCallback(playerFunc func)
+{
+    on_player = func;
+}
+
+void CInsimRegistry::link(byte PLID, byte UCID)
+{
+    struct connInfo* conn = touch(UCID);
+
+    players[PLID].UCID = UCID;
+    players[PLID].nextPLID = conn->firstPLID;
+    conn->firstPLID = PLID;
+}
+
+void CInsimRegistry::unlink(byte PLID)
+{
+    byte* next = &conns[players[PLID].UCID].firstPLID;
+
+    while (*next != 0)
+    {
+        if (*next == PLID)
+        {
+            *next = players[PLID].nextPLID;
+            break;
+        }
+        next = &players[*next].nextPLID;
+    }
+
+    players[PLID].nextPLID = 0;
+}
+
+void CInsimRegistry::remove_player(byte PLID)
+{
+    if (!players[PLID].inUse)
+        return;
+
+    if (on_player)
+        on_player(&players[PLID], PLY_LEFT);
+
+    unlink(PLID);
+    players[PLID].inUse = false;
+    player_count--;
+}
+
+struct connInfo* CInsimRegistry::touch(byte UCID)
+{
+    struct connInfo* conn = &conns[UCID];
+
+    if (!conn->inUse)
+    {
+        memset(conn, 0, sizeof(struct connInfo));
+        conn->inUse = true;
+        conn->UCID = UCID;
+        conn_count++;
+    }
+
+    return conn;
+}
+
+void CInsimRegistry::update(void* packet)
+{
+    struct connInfo* conn = nullptr;
+    int change;
+
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_NCN:
+        {
+            struct IS_NCN* ncn = (struct IS_NCN*)packet;
+            conn = touch(ncn->UCID);
+            conn->Admin = ncn->Admin;
+            conn->Flags = ncn->Flags;
+            memcpy(conn->UName, ncn->UName, sizeof(conn->UName));
+            memcpy(conn->PName, ncn->PName, sizeof(conn->PName));
+            change = CONN_NEW;
+            break;
+        }
+
+        case ISP_NCI:
+        {
+            struct IS_NCI* nci = (struct IS_NCI*)packet;
+            conn = touch(nci->UCID);
+            conn->Language = nci->Language;
+            conn->License = nci->License;
+            conn->UserID = nci->UserID;
+            conn->IPAddress = nci->IPAddress;
+            change = CONN_INFO;
+            break;
+        }
+
+        case ISP_CPR:
+        {
+            struct IS_CPR* cpr = (struct IS_CPR*)packet;
+            conn = touch(cpr->UCID);
+            memcpy(conn->PName, cpr->PName, sizeof(conn->PName));
+            memcpy(conn->Plate, cpr->Plate, sizeof(conn->Plate));
+            change = CONN_RENAMED;
+            break;
+        }
+
+        case ISP_CIM:
+        {
+            struct IS_CIM* cim = (struct IS_CIM*)packet;
+            conn = touch(cim->UCID);
+            conn->Mode = cim->Mode;
+            conn->SubMode = cim->SubMode;
+            conn->SelType = cim->SelType;
+            change = CONN_MODE;
+            break;
+        }
+
+        case ISP_SLC:
+        {
+            struct IS_SLC* slc = (struct IS_SLC*)packet;
+            conn = touch(slc->UCID);
+            memcpy(conn->CName, slc->CName, sizeof(conn->CName));
+            change = CONN_CAR;
+            break;
+        }
+
+        case ISP_CNL:
+        {
+            conn = &conns[((struct IS_CNL*)packet)->UCID];
+
+            if (!conn->inUse)
+                return;
+
+            // LFS removes the players first, this only catches what we missed
+            while (conn->firstPLID != 0)
+                remove_player(conn->firstPLID);
+
+            if (on_conn)
+                on_conn(conn, CONN_LEFT);
+
+            conn->inUse = false;
+            conn_count--;
+            return;
+        }
+
+        case ISP_NPL:
+        {
+            struct IS_NPL* npl = (struct IS_NPL*)packet;
+
+            if (npl->NumP == 0)             // Join request, not in the race yet
+                return;
+
+            struct plyInfo* ply = &players[npl->PLID];
+            int pchange = PLY_LEFT_PITS;
+
+            if (!ply->inUse)
+            {
+                memset(ply, 0, sizeof(struct plyInfo));
+                ply->inUse = true;
+                ply->PLID = npl->PLID;
+                link(npl->PLID, npl->UCID);
+                player_count++;
+                pchange = PLY_NEW;
+            }
+            else if (ply->UCID != npl->UCID)
+            {
+                unlink(npl->PLID);
+                link(npl->PLID, npl->UCID);
+            }
+
+            ply->inPits = false;
+            ply->PType = npl->PType;
+            ply->Flags = npl->Flags;
+            memcpy(ply->PName, npl->PName, sizeof(ply->PName));
+            memcpy(ply->Plate, npl->Plate, sizeof(ply->Plate));
+            memcpy(ply->CName, npl->CName, sizeof(ply->CName));
+            memcpy(ply->SName, npl->SName, sizeof(ply->SName));
+            memcpy(ply->Tyres, npl->Tyres, sizeof(ply->Tyres));
+            ply->H_Mass = npl->H_Mass;
+            ply->H_TRes = npl->H_TRes;
+            ply->Model = npl->Model;
+            ply->Pass = npl->Pass;
+            ply->RWAdj = npl->RWAdj;
+            ply->FWAdj = npl->FWAdj;
+            ply->SetF = npl->SetF;
+            ply->NumP = npl->NumP;
+            ply->Config = npl->Config;
+            ply->Fuel = npl->Fuel;
+
+            if (on_player)
+                on_player(ply, pchange);
+            return;
+        }
+
+        case ISP_PLP:
+        {
+            struct plyInfo* ply = &players[((struct IS_PLP*)packet)->PLID];
+
+            if (!ply->inUse)
+                return;
+
+            ply->inPits = true;
+
+            if (on_player)
+                on_player(ply, PLY_PITS);
+            return;
+        }
+
+        case ISP_PLL:
+            remove_player(((struct IS_PLL*)packet)->PLID);
+            return;
+
+        case ISP_TOC:
+        {
+            struct IS_TOC* toc = (struct IS_TOC*)packet;
+            struct plyInfo* ply = &players[toc->PLID];
+
+            if (!ply->inUse)
+                return;
+
+            unlink(toc->PLID);
+            link(toc->PLID, toc->NewUCID);
+
+            if (on_player)
+                on_player(ply, PLY_TAKEOVER);
+            return;
+        }
+
+        case ISP_TINY:
+            // Multiplayer ended: every connection is gone
+            if (((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            // Race cleared: every player is gone
+            else if (((struct IS_TINY*)packet)->SubT == TINY_CLR)
+                clear_players();
+            return;
+
+        default:
+            return;
+    }
+
+    if (on_conn)
+        on_conn(conn, change);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimRegistry
+ * ==============
+ *
+ * Built-in tracking of the host state. Each CInsim keeps a registry up to date
+ * from the packets it receives (see CInsim::getRegistry()), so applications
+ * don't have to maintain their own maps of connections and players.
+ *
+ * Connections and players live in flat arrays indexed by UCID and PLID:
+ * lookups are a single index and nothing is allocated once the registry
+ * exists. The players of a connection are chained through their PLIDs
+ * (connInfo::firstPLID, plyInfo::nextPLID), so take-overs only relink them.
+ */
+
+#ifndef _CINSIMREGISTRY_H
+#define _CINSIMREGISTRY_H
+
+#include "CInsim.h"
+
+// What changed in a connection, passed to the connection callback
+enum
+{
+    CONN_NEW,               // IS_NCN
+    CONN_LEFT,              // IS_CNL, the entry is still filled in during the callback
+    CONN_RENAMED,           // IS_CPR
+    CONN_INFO,              // IS_NCI
+    CONN_MODE,              // IS_CIM
+    CONN_CAR,               // IS_SLC
+};
+
+// What changed in a player, passed to the player callback
+enum
+{
+    PLY_NEW,                // IS_NPL for an unknown PLID
+    PLY_LEFT_PITS,          // IS_NPL for a known PLID (details may have changed)
+    PLY_PITS,               // IS_PLP, the player stays in the list
+    PLY_LEFT,               // IS_PLL, the entry is still filled in during the callback
+    PLY_TAKEOVER,           // IS_TOC, UCID is already the new connection's
+};
+
+// A connection, indexed by UCID
+struct connInfo
+{
+    bool    inUse;                      // The slot holds a connection
+    byte    UCID;                       // connection's unique id (0 = host)
+    byte    Admin;                      // 1 if admin
+    byte    Flags;                      // bit 2: remote
+    char    UName[24];                  // username
+    char    PName[24];                  // nickname
+    char    Plate[8];                   // number plate from the last IS_CPR - NO ZERO AT END!
+
+    byte    Language;                   // IS_NCI (host only, if an admin password has been set)
+    byte    License;                    // 0:demo / 1:S1 ...
+    unsigned UserID;                    // LFS UserID, 0 if unknown
+    unsigned IPAddress;
+
+    byte    Mode;                       // IS_CIM mode identifier
+    byte    SubMode;
+    byte    SelType;
+
+    char    CName[4];                   // selected car from IS_SLC, empty if none
+
+    byte    firstPLID;                  // First player of this connection, 0 if none
+};
+
+// A player, indexed by PLID
+struct plyInfo
+{
+    bool    inUse;                      // The slot holds a player
+    bool    inPits;                     // Went to the pits (IS_PLP), until the next IS_NPL
+    byte    PLID;                       // player's unique id
+    byte    UCID;                       // connection driving the car
+    byte    nextPLID;                   // Next player of the same connection, 0 if none
+
+    byte    PType;                      // bit 0: female / bit 1: AI / bit 2: remote
+    word    Flags;                      // player flags
+    char    PName[24];                  // nickname
+    char    Plate[8];                   // number plate - NO ZERO AT END!
+    char    CName[4];                   // car name
+    char    SName[16];                  // skin name
+    byte    Tyres[4];                   // compounds
+    byte    H_Mass;                     // added mass (kg)
+    byte    H_TRes;                     // intake restriction
+    byte    Model;                      // driver model
+    byte    Pass;                       // passengers byte
+    byte    RWAdj;                      // low 4 bits: tyre width reduction (rear)
+    byte    FWAdj;                      // low 4 bits: tyre width reduction (front)
+    byte    SetF;                       // setup flags
+    byte    NumP;                       // number in race when the last IS_NPL was sent
+    byte    Config;                     // car config
+    byte    Fuel;                       // /showfuel yes: fuel percent / no: 255
+};
+
+/**
+* CInsimRegistry class holding the connections and players of a host
+*/
+class CInsimRegistry
+{
+  public:
+    // Called after a connection changed (before it is removed for CONN_LEFT)
+    typedef std::function<void (const struct connInfo* conn, int change)> connFunc;
+    // Called after a player changed (before it is removed for PLY_LEFT)
+    typedef std::function<void (const struct plyInfo* player, int change)> playerFunc;
+
+  private:
+    struct connInfo conns[256];
+    int conn_count;                     // Slots in use
+    connFunc on_conn;
+
+    struct plyInfo players[256];
+    int player_count;
+    playerFunc on_player;
+
+    struct connInfo* touch(byte UCID);  // Entry for a UCID, registered if it wasn't known yet
+    void link(byte PLID, byte UCID);    // Adds a player to the list of a connection
+    void unlink(byte PLID);             // Removes a player from the list of its connection
+    void remove_player(byte PLID);
+    void clear_players();
+
+  public:
+    CInsimRegistry();
+
+    void clear();                       // Forgets every connection and player
+    void update(void* packet);          // Applies a packet received from LFS. Other types are ignored
+
+    void setConnCallback(connFunc func);
+    void setPlayerCallback(playerFunc func);
+
+    const struct connInfo* getConn(byte UCID) { return conns[UCID].inUse ? &conns[UCID] : nullptr; }
+    int connCount() { return conn_count; }
+
+    const struct plyInfo* getPlayer(byte PLID) { return players[PLID].inUse ? &players[PLID] : nullptr; }
+    const struct connInfo* getPlayerConn(byte PLID) { return players[PLID].inUse ? getConn(players[PLID].UCID) : nullptr; }
+    int playerCount() { return player_count; }
+};
+
+#endif
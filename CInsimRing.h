@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimRing
+ * ==========
+ *
+ * Single producer, single consumer ring to hand decoded telemetry (e.g.
+ * OutSimPack2 or OutGaugePack) from the receiving thread to an analysis
+ * thread. The producer never blocks nor allocates: when the consumer falls
+ * behind and the ring is full, the new element is dropped and counted as an
+ * overrun. The consumer either takes every element in order with pop(), or
+ * only the newest with pop_latest(), which skips (and counts) the older ones.
+ *
+ * A consumer that only wants the newest data (a dashboard, a live chart) uses
+ * the latest-only mode (Latest = true): a full ring overwrites its oldest
+ * element instead, counted as skipped, so pop_latest() is never more than one
+ * element late. The consumer then advances its index with a CAS and copies an
+ * element again if the producer overwrote it meanwhile, so T should be small
+ * and trivially copyable.
+ *
+ * The storage is part of the object. The producer and consumer indexes are
+ * padded apart so they never share a cache line, and each side keeps a copy
+ * of the other's index, so it only reads the other line when the ring looks
+ * full or empty.
+ */
+
+#ifndef _CINSIMRING_H
+#define _CINSIMRING_H
+
+#include <atomic>
+#include <cstring>
+
+#define IS_CACHE_LINE 64
+
+/**
+* CInsimRing class to pass elements from one thread to another without locks
+* N (the capacity) must be a power of 2. Latest: overwrite the oldest element when full
+*/
+template <typename T, unsigned N, bool Latest = false>
+class CInsimRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "CInsimRing: the capacity must be a power of 2");
+
+  private:
+    char pad0[IS_CACHE_LINE];
+
+    // Producer side
+    std::atomic<unsigned> head;         // Next slot written
+    unsigned tail_cache;                // Last tail seen by the producer
+    std::atomic<unsigned long long> overruns;
+    char pad1[IS_CACHE_LINE];
+
+    // Consumer side
+    std::atomic<unsigned> tail;         // Next slot read
+    unsigned head_cache;                // Last head seen by the consumer
+    std::atomic<unsigned long long> skipped;
+    char pad2[IS_CACHE_LINE];
+
+    T buffer[N];
+
+  public:
+    CInsimRing() : head(0), tail_cache(0), overruns(0), tail(0), head_cache(0), skipped(0) {}
+
+    CInsimRing(const CInsimRing&) = delete;
+    CInsimRing& operator=(const CInsimRing&) = delete;
+
+    /** @brief Slot for the next element (producer)
+     *
+     * The element can be built in place, e.g. CInsimOutSim::decode() straight
+     * into the ring, then handed over with publish(). The slot still holds an
+     * element from N pushes ago.
+     *
+     * @return T* Slot, or nullptr if the ring is full (counted as an overrun). Never nullptr if Latest
+     *
+     */
+    T* claim()
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+
+        if (h - tail_cache == N)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            while (h - tail_cache == N)
+            {
+                if (!Latest)
+                {
+                    overruns.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                // Latest only: the oldest element makes room, unless the consumer just took it
+                if (tail.compare_exchange_weak(tail_cache, tail_cache + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    tail_cache++;
+                    skipped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        return &buffer[h & (N - 1)];
+    }
+
+    void publish()                      // Hands over the slot returned by claim() (producer)
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool push(const T& element)         // Copies an element in (producer). false if the ring was full
+    {
+        T* slot = claim();
+
+        if (!slot)
+            return false;
+
+        *slot = element;
+        publish();
+        return true;
+    }
+
+    bool pop(T* out)                    // Takes the oldest element (consumer). false if the ring is empty
+    {
+        unsigned t = tail.load(Latest ? std::memory_order_acquire : std::memory_order_relaxed);
+
+        for (;;)
+        {
+            // The producer may have moved tail past head_cache (Latest)
+            if ((int)(head_cache - t) <= 0)
+            {
+                head_cache = head.load(std::memory_order_acquire);
+                if (t == head_cache)
+                    return false;
+            }
+
+            *out = buffer[t & (N - 1)];
+
+            if (!Latest)
+            {
+                tail.store(t + 1, std::memory_order_release);
+                return true;
+            }
+
+            // tail moved while copying: the slot may have been overwritten. t is reloaded
+            if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+                return true;
+        }
+    }
+
+    bool pop_latest(T* out)             // Takes the newest element and drops the older ones (consumer). false if the ring is empty
+    {
+        unsigned t = tail.load(Latest ? std::memory_order_acquire : std::memory_order_relaxed);
+
+        for (;;)
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t == head_cache)
+                return false;
+
+            *out = buffer[(head_cache - 1) & (N - 1)];
+
+            if (!Latest)
+            {
+                tail.store(head_cache, std::memory_order_release);
+                break;
+            }
+
+            if (tail.compare_exchange_strong(t, head_cache, std::memory_order_acq_rel, std::memory_order_acquire))
+                break;
+        }
+
+        if (head_cache - t > 1)
+            skipped.fetch_add(head_cache - t - 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    unsigned size()                     // Elements waiting. Exact only from one of both threads
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    unsigned capacity() { return N; }
+    unsigned long long getOverruns() { return overruns.load(std::memory_order_relaxed); }   // Elements dropped because the ring was full (0 if Latest)
+    unsigned long long getSkipped() { return skipped.load(std::memory_order_relaxed); }     // Elements passed over by pop_latest() or overwritten (Latest)
+};
+
+#endif
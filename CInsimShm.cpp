@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimShm
+ * =========
+ *
+ * Publication of the live race state in POSIX shared memory. See CInsimShm.h
+ */
+
+#include <CInsimShm.h>
+
+#ifdef CIS_LINUX
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+CInsimShm::CInsimShm()
+{
+    state = nullptr;
+}
+
+CInsimShm::~CInsimShm()
+{
+    close();
+}
+
+int CInsimShm::open(const std::string name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, sizeof(struct shmState)) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    void* mem = mmap(NULL, sizeof(struct shmState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mem == MAP_FAILED)
+        return -1;
+
+    this->name = name;
+    state = (struct shmState*)mem;
+
+    // Readers of a previous producer still mapping the segment see a write in progress
+    unsigned seq = state->seq.load(std::memory_order_relaxed) | 1;
+    state->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    state->magic = IS_SHM_MAGIC;
+    state->layout = IS_SHM_LAYOUT;
+    state->updates = 0;
+    memset(state->cars, 0, sizeof(state->cars));
+    memset(state->conns, 0, sizeof(state->conns));
+
+    state->seq.store(seq + 1, std::memory_order_release);
+    return 0;
+}
+
+void CInsimShm::close()
+{
+    if (!state)
+        return;
+
+    munmap(state, sizeof(struct shmState));
+    shm_unlink(name.c_str());
+    state = nullptr;
+}
+
+void CInsimShm::clear()
+{
+    if (!state)
+        return;
+
+    unsigned seq = state->seq.load(std::memory_order_relaxed);
+    state->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memset(state->cars, 0, sizeof(state->cars));
+    memset(state->conns, 0, sizeof(state->conns));
+
+    state->updates++;
+    state->seq.store(seq + 2, std::memory_order_release);
+}
+
+void CInsimShm::update(void* packet)
+{
+    if (!state)
+        return;
+
+    byte type = *((byte*)packet + 1);
+
+    switch (type)
+    {
+        case ISP_MCI:
+        case ISP_NLP:
+        case ISP_NPL:
+        case ISP_PLL:
+        case ISP_NCN:
+        case ISP_CNL:
+        case ISP_CPR:
+            break;
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT != TINY_MPE && ((struct IS_TINY*)packet)->SubT != TINY_CLR)
+                return;
+            break;
+
+        default:
+            return;
+    }
+
+    // Readers never hold us up: they retry if they overlap this write
+    unsigned seq = state->seq.load(std::memory_order_relaxed);
+    state->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    switch (type)
+    {
+        case ISP_MCI:
+        {
+            struct IS_MCI* mci = (struct IS_MCI*)packet;
+            int numc = mci->NumC > MCI_MAX_CARS ? MCI_MAX_CARS : mci->NumC;
+
+            for (int i = 0; i < numc; i++)
+            {
+                CompCar* info = &mci->Info[i];
+                struct shmCar* car = &state->cars[info->PLID];
+
+                car->inRace = 1;
+                car->Position = info->Position;
+                car->Info = info->Info;
+                car->Node = info->Node;
+                car->Lap = info->Lap;
+                car->X = info->X;
+                car->Y = info->Y;
+                car->Z = info->Z;
+                car->Speed = info->Speed;
+                car->Direction = info->Direction;
+                car->Heading = info->Heading;
+                car->AngVel = info->AngVel;
+            }
+            break;
+        }
+
+        case ISP_NLP:
+        {
+            struct IS_NLP* nlp = (struct IS_NLP*)packet;
+            int nump = nlp->NumP > NLP_MAX_CARS ? NLP_MAX_CARS : nlp->NumP;
+
+            for (int i = 0; i < nump; i++)
+            {
+                NodeLap* info = &nlp->Info[i];
+                struct shmCar* car = &state->cars[info->PLID];
+
+                car->inRace = 1;
+                car->Position = info->Position;
+                car->Node = info->Node;
+                car->Lap = info->Lap;
+            }
+            break;
+        }
+
+        case ISP_NPL:
+            state->cars[((struct IS_NPL*)packet)->PLID].inRace = 1;
+            break;
+
+        case ISP_PLL:
+            memset(&state->cars[((struct IS_PLL*)packet)->PLID], 0, sizeof(struct shmCar));
+            break;
+
+        case ISP_NCN:
+        {
+            struct IS_NCN* ncn = (struct IS_NCN*)packet;
+            struct shmConn* conn = &state->conns[ncn->UCID];
+
+            conn->inUse = 1;
+            conn->Admin = ncn->Admin;
+            conn->Flags = ncn->Flags;
+            memcpy(conn->UName, ncn->UName, sizeof(conn->UName));
+            memcpy(conn->PName, ncn->PName, sizeof(conn->PName));
+            break;
+        }
+
+        case ISP_CNL:
+            memset(&state->conns[((struct IS_CNL*)packet)->UCID], 0, sizeof(struct shmConn));
+            break;
+
+        case ISP_CPR:
+        {
+            struct IS_CPR* cpr = (struct IS_CPR*)packet;
+            memcpy(state->conns[cpr->UCID].PName, cpr->PName, sizeof(cpr->PName));
+            break;
+        }
+
+        // Race cleared: every car is gone. Multiplayer ended: the connections too
+        case ISP_TINY:
+            memset(state->cars, 0, sizeof(state->cars));
+            if (((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                memset(state->conns, 0, sizeof(state->conns));
+            break;
+    }
+
+    state->updates++;
+    state->seq.store(seq + 2, std::memory_order_release);
+}
+
+CInsimShmReader::CInsimShmReader()
+{
+    state = nullptr;
+}
+
+CInsimShmReader::~CInsimShmReader()
+{
+    close();
+}
+
+int CInsimShmReader::open(const std::string name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct shmState))
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    void* mem = mmap(NULL, sizeof(struct shmState), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mem == MAP_FAILED)
+        return -1;
+
+    state = (const struct shmState*)mem;
+
+    if (state->magic != IS_SHM_MAGIC || state->layout != IS_SHM_LAYOUT)
+    {
+        #ifdef IS_DEBUG
+        std::cout << "CInsimShmReader::open - Unknown segment layout" << std::endl;
+        #endif // IS_DEBUG
+        close();
+        return -1;
+    }
+
+    return 0;
+}
+
+void CInsimShmReader::close()
+{
+    if (!state)
+        return;
+
+    munmap((void*)state, sizeof(struct shmState));
+    state = nullptr;
+}
+
+int CInsimShmReader::snapshot(struct shmSnapshot* out)
+{
+    if (!state)
+        return -1;
+
+    for (int i = 0; i < IS_SHM_RETRIES; i++)
+    {
+        unsigned seq = state->seq.load(std::memory_order_acquire);
+
+        if (seq & 1)                    // The producer is writing
+            continue;
+
+        out->updates = state->updates;
+        memcpy(out->cars, state->cars, sizeof(out->cars));
+        memcpy(out->conns, state->conns, sizeof(out->conns));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (state->seq.load(std::memory_order_relaxed) == seq)
+            return 0;
+    }
+
+    return -1;
+}
+
+#endif // CIS_LINUX
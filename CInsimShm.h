@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimShm
+ * =========
+ *
+ * Publication of the live race state in POSIX shared memory (*NIX only).
+ * CInsim::publishState() makes a connection copy the car table (from IS_MCI
+ * and IS_NLP) and the connection table (from IS_NCN, IS_CNL and IS_CPR) into
+ * a shared memory segment guarded by a seqlock. Other local processes read it
+ * with CInsimShmReader: taking a snapshot needs neither locks nor syscalls, and
+ * the producer never waits for the readers. The tables are emptied as those of
+ * CInsimRegistry are: on init(), on reconnections and on TINY_MPE (the cars
+ * only on TINY_CLR).
+ */
+
+#ifndef _CINSIMSHM_H
+#define _CINSIMSHM_H
+
+#include "CInsim.h"
+
+#ifdef CIS_LINUX
+
+#include <atomic>
+#include <string>
+
+#define IS_SHM_MAGIC 0x4D485349         // "ISHM"
+#define IS_SHM_LAYOUT 1                 // Incremented whenever shmState changes
+#define IS_SHM_RETRIES 1000             // Attempts of CInsimShmReader::snapshot() before giving up
+
+// A car, indexed by PLID
+struct shmCar
+{
+    byte    inRace;                     // 1 if the slot holds a car
+    byte    Position;                   // current race position: 0 = unknown, 1 = leader, etc...
+    byte    Info;                       // CCI_ flags
+    byte    Sp3;
+    word    Node;                       // current path node
+    word    Lap;                        // current lap
+    int     X;                          // X map (65536 = 1 metre)
+    int     Y;                          // Y map (65536 = 1 metre)
+    int     Z;                          // Z alt (65536 = 1 metre)
+    word    Speed;                      // speed (32768 = 100 m/s)
+    word    Direction;                  // car's motion if Speed > 0: 0 = world y direction, 32768 = 180 deg
+    word    Heading;                    // direction of forward axis: 0 = world y direction, 32768 = 180 deg
+    short   AngVel;                     // signed, rate of change of heading: (16384 = 360 deg/s)
+};
+
+// A connection, indexed by UCID
+struct shmConn
+{
+    byte    inUse;                      // 1 if the slot holds a connection
+    byte    Admin;                      // 1 if admin
+    byte    Flags;                      // bit 2: remote
+    byte    Sp3;
+    char    UName[24];                  // username
+    char    PName[24];                  // nickname
+};
+
+// Layout of the shared memory segment
+struct shmState
+{
+    unsigned magic;                     // IS_SHM_MAGIC once the producer has initialised the segment
+    unsigned layout;                    // IS_SHM_LAYOUT
+    std::atomic<unsigned> seq;          // Seqlock: odd while the producer is writing
+    unsigned updates;                   // Number of packets applied so far
+    struct shmCar cars[256];
+    struct shmConn conns[256];
+};
+
+// The part of shmState copied by the readers
+struct shmSnapshot
+{
+    unsigned updates;
+    struct shmCar cars[256];
+    struct shmConn conns[256];
+};
+
+/**
+* CInsimShm class to publish the race state of a connection (producer side)
+*/
+class CInsimShm
+{
+  private:
+    std::string name;
+    struct shmState* state;
+
+  public:
+    CInsimShm();
+    ~CInsimShm();
+
+    CInsimShm(const CInsimShm&) = delete;
+    CInsimShm& operator=(const CInsimShm&) = delete;
+
+    int open(const std::string name);   // Creates (or takes over) the segment, e.g. "/insim_state". -1 on error
+    void close();                       // Unmaps and removes the segment
+
+    void clear();                       // Empties the car and connection tables (on init() and reconnections)
+    void update(void* packet);          // Applies a packet received from LFS. Other types are ignored
+};
+
+/**
+* CInsimShmReader class to take consistent snapshots of a published state (reader side)
+*/
+class CInsimShmReader
+{
+  private:
+    const struct shmState* state;
+
+  public:
+    CInsimShmReader();
+    ~CInsimShmReader();
+
+    CInsimShmReader(const CInsimShmReader&) = delete;
+    CInsimShmReader& operator=(const CInsimShmReader&) = delete;
+
+    int open(const std::string name);   // Maps the segment read only. -1 if it doesn't exist or has another layout
+    void close();
+
+    /** @brief Copy a consistent state
+     *
+     * @param shmSnapshot* Destination
+     * @return int 0 on success, -1 if not open or the producer kept writing for IS_SHM_RETRIES attempts
+     *
+     */
+    int snapshot(struct shmSnapshot* out);
+};
+
+#endif // CIS_LINUX
+
+#endif
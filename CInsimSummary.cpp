@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimSummary
+ * =============
+ *
+ * Multi-resolution summary of a telemetry trace. See CInsimSummary.h
+ */
+
+#include <CInsimSummary.h>
+
+#include <cmath>
+
+CInsimSummary::CInsimSummary(unsigned factor, int levelCount, unsigned capacity)
+{
+    if (factor < 2)
+        throw new std::logic_error("CInsimSummary: factor must be 2 or more");
+
+    if (levelCount < 1 || levelCount > IS_SUMMARY_LEVELS)
+        throw new std::logic_error("CInsimSummary: the number of levels must be between 1 and IS_SUMMARY_LEVELS");
+
+    if (capacity == 0)
+        throw new std::logic_error("CInsimSummary: capacity can't be 0");
+
+    this->factor = factor;
+    this->capacity = capacity;
+    levels.resize(levelCount);
+
+    for (int k = 0; k < levelCount; k++)
+    {
+        levels[k].ring.resize(capacity);
+        levels[k].candidates[0].reserve(factor);
+        levels[k].candidates[1].reserve(factor);
+    }
+
+    clear();
+}
+
+void CInsimSummary::clear()
+{
+    for (size_t k = 0; k < levels.size(); k++)
+    {
+        struct sumLevel* l = &levels[k];
+
+        l->count = 0;
+        l->filled = 0;
+        l->candidates[0].clear();
+        l->candidates[1].clear();
+    }
+
+    samples = 0;
+}
+
+unsigned long long CInsimSummary::bucketSamples(int level)
+{
+    unsigned long long n = factor;
+
+    for (int k = 0; k < level; k++)
+        n *= factor;
+
+    return n;
+}
+
+void CInsimSummary::add(unsigned time, float value)
+{
+    struct sumBucket s;
+
+    s.time = s.endTime = s.minTime = s.maxTime = s.meanTime = time;
+    s.min = s.max = s.first = s.last = s.mean = value;
+    s.count = 1;
+
+    struct sumPoint p = { time, value };
+
+    // Every sample is a candidate of its level 0 bucket
+    candidate(0, samples / factor, p);
+    samples++;
+    merge(0, &s);
+}
+
+void CInsimSummary::candidate(int level, unsigned long long index, const struct sumPoint& p)
+{
+    std::vector<struct sumPoint>* c = &levels[level].candidates[index & 1];
+
+    if (c->size() < factor)
+        c->push_back(p);
+}
+
+void CInsimSummary::merge(int level, const struct sumBucket* child)
+{
+    struct sumLevel* l = &levels[level];
+    struct sumBucket* b = &l->open;
+
+    if (l->filled == 0)
+    {
+        *b = *child;
+        b->picked = false;
+        l->sum = 0;
+        l->sumTime = 0;
+    }
+    else
+    {
+        b->endTime = child->endTime;
+        b->count += child->count;
+        b->last = child->last;
+
+        if (child->min < b->min)
+        {
+            b->min = child->min;
+            b->minTime = child->minTime;
+        }
+
+        if (child->max > b->max)
+        {
+            b->max = child->max;
+            b->maxTime = child->maxTime;
+        }
+    }
+
+    l->sum += (double)child->mean * child->count;
+    l->sumTime += (double)(child->meanTime - b->time) * child->count;
+
+    if (++l->filled == factor)
+        close(level);
+}
+
+/**
+* A bucket is complete: the previous one can be picked, and the level above gets both
+*/
+void CInsimSummary::close(int level)
+{
+    struct sumLevel* l = &levels[level];
+    struct sumBucket* b = &l->open;
+    unsigned long long index = l->count;
+
+    b->mean = l->sum / b->count;
+    b->meanTime = b->time + (unsigned)(l->sumTime / b->count + 0.5);
+
+    l->ring[index % capacity] = *b;
+    l->count++;
+    l->filled = 0;
+
+    if (index > 0)
+        pick(level, index - 1, b);
+
+    if (level + 1 < (int)levels.size())
+        merge(level + 1, &l->ring[index % capacity]);
+}
+
+void CInsimSummary::pick(int level, unsigned long long index, const struct sumBucket* next)
+{
+    struct sumLevel* l = &levels[level];
+    std::vector<struct sumPoint>* c = &l->candidates[index & 1];
+
+    if (c->empty())
+        return;
+
+    struct sumPoint best = c->front();
+
+    // The first bucket keeps its first point, as the first point of the trace
+    if (index > 0)
+    {
+        double area = -1;
+        double ax = (double)(int)(next->meanTime - l->prev.time);
+        double ay = next->mean - l->prev.value;
+
+        for (size_t i = 0; i < c->size(); i++)
+        {
+            const struct sumPoint* p = &(*c)[i];
+            double a = fabs(ax * (p->value - l->prev.value) - (double)(int)(p->time - l->prev.time) * ay);
+
+            if (a > area)
+            {
+                area = a;
+                best = *p;
+            }
+        }
+    }
+
+    c->clear();
+    l->prev = best;
+
+    if (index + capacity >= l->count)
+    {
+        struct sumBucket* b = &l->ring[index % capacity];
+        b->point = best;
+        b->picked = true;
+    }
+
+    if (level + 1 < (int)levels.size())
+        candidate(level + 1, index / factor, best);
+}
+
+unsigned long long CInsimSummary::firstBucket(int level)
+{
+    if (level < 0 || level >= (int)levels.size())
+        return 0;
+
+    unsigned long long count = levels[level].count;
+    return count > capacity ? count - capacity : 0;
+}
+
+unsigned long long CInsimSummary::bucketCount(int level)
+{
+    if (level < 0 || level >= (int)levels.size())
+        return 0;
+
+    return levels[level].count;
+}
+
+const struct sumBucket* CInsimSummary::getBucket(int level, unsigned long long index)
+{
+    if (level < 0 || level >= (int)levels.size())
+        return nullptr;
+
+    if (index < firstBucket(level) || index >= levels[level].count)
+        return nullptr;
+
+    return &levels[level].ring[index % capacity];
+}
+
+/**
+* First bucket kept that ends at or after a time
+*/
+unsigned long long CInsimSummary::find(int level, unsigned time)
+{
+    unsigned long long lo = firstBucket(level);
+    unsigned long long hi = levels[level].count;
+
+    while (lo < hi)
+    {
+        unsigned long long mid = lo + (hi - lo) / 2;
+
+        if (levels[level].ring[mid % capacity].endTime < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+int CInsimSummary::chooseLevel(unsigned from, unsigned to, int buckets)
+{
+    for (int k = 0; k < (int)levels.size(); k++)
+    {
+        const struct sumBucket* oldest = getBucket(k, firstBucket(k));
+
+        if (!oldest)
+            continue;
+
+        // Samples before from may only be missing when the ring dropped them
+        if (firstBucket(k) > 0 && oldest->time > from)
+            continue;
+
+        unsigned long long first = find(k, from);
+        unsigned long long last = find(k, to);
+
+        if (last < levels[k].count && levels[k].ring[last % capacity].time <= to)
+            last++;
+
+        if (last - first <= (unsigned long long)buckets)
+            return k;
+    }
+
+    return -1;
+}
+
+int CInsimSummary::minMax(int level, unsigned from, unsigned to, struct sumPoint* out, int max)
+{
+    if (level < 0 || level >= (int)levels.size())
+        return 0;
+
+    int n = 0;
+
+    for (unsigned long long j = find(level, from); j < levels[level].count; j++)
+    {
+        const struct sumBucket* b = &levels[level].ring[j % capacity];
+
+        if (b->time > to || n + 2 > max)
+            break;
+
+        struct sumPoint lo = { b->minTime, b->min };
+        struct sumPoint hi = { b->maxTime, b->max };
+
+        if (lo.time > hi.time)
+            std::swap(lo, hi);
+
+        out[n++] = lo;
+        if (b->minTime != b->maxTime)
+            out[n++] = hi;
+    }
+
+    return n;
+}
+
+int CInsimSummary::lttb(int level, unsigned from, unsigned to, struct sumPoint* out, int max)
+{
+    if (level < 0 || level >= (int)levels.size())
+        return 0;
+
+    int n = 0;
+
+    for (unsigned long long j = find(level, from); j < levels[level].count && n < max; j++)
+    {
+        const struct sumBucket* b = &levels[level].ring[j % capacity];
+
+        if (b->time > to)
+            break;
+
+        if (b->picked)
+            out[n++] = b->point;
+        else
+        {
+            struct sumPoint p = { b->endTime, b->last };
+            out[n++] = p;
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimSummary
+ * =============
+ *
+ * Multi-resolution summary of a telemetry trace built as the samples arrive,
+ * e.g. the speed of a car from OutSim (100 Hz) or from IS_MCI (25 Hz), so a
+ * chart of a whole race can be drawn from a few hundred points computed in
+ * advance instead of from the raw samples.
+ *
+ * Level 0 has a bucket every factor samples, level 1 every factor buckets of
+ * level 0, and so on. Each bucket keeps its minimum and maximum (with their
+ * times), first, last and mean value, and one point picked by
+ * largest-triangle-three-buckets (LTTB): the one forming the largest triangle
+ * with the point picked in the previous bucket and the mean of the next one.
+ * The candidates of a bucket are its samples on level 0, and the points
+ * picked in its children on the levels above, so a bucket is picked as soon
+ * as the next one is complete, and only two buckets of candidates are kept
+ * per level.
+ *
+ * Every level is a ring of the last capacity buckets: memory doesn't depend
+ * on the length of the trace. The coarse levels cover the whole session, the
+ * fine ones its recent part. Times are in ms and must not decrease.
+ */
+
+#ifndef _CINSIMSUMMARY_H
+#define _CINSIMSUMMARY_H
+
+#include "CInsim.h"
+
+#define IS_SUMMARY_LEVELS 16            // Maximum number of levels
+
+// A sample of a trace
+struct sumPoint
+{
+    unsigned    time;                   // (ms)
+    float       value;
+};
+
+// Summary of consecutive samples
+struct sumBucket
+{
+    unsigned    time;                   // Of the first sample (ms)
+    unsigned    endTime;                // Of the last sample (ms)
+    unsigned    count;                  // Samples
+
+    float       min;
+    float       max;
+    unsigned    minTime;
+    unsigned    maxTime;
+    float       first;
+    float       last;
+    float       mean;
+    unsigned    meanTime;
+
+    struct sumPoint point;              // Picked by LTTB
+    bool        picked;                 // false until the next bucket is complete
+};
+
+/**
+* CInsimSummary class to downsample a trace at several resolutions as it is recorded
+*/
+class CInsimSummary
+{
+  private:
+    struct sumLevel
+    {
+        std::vector<struct sumBucket> ring;     // Bucket j in ring[j % capacity]
+        unsigned long long count;       // Buckets complete
+
+        struct sumBucket open;          // Bucket being filled
+        unsigned filled;                // Samples or children in it
+        double sum;                     // Of its values, and of their times relative to open.time
+        double sumTime;
+
+        std::vector<struct sumPoint> candidates[2];     // Of the buckets with an even and an odd index
+        struct sumPoint prev;           // Last point picked
+    };
+
+    unsigned factor;
+    unsigned capacity;
+    std::vector<struct sumLevel> levels;
+    unsigned long long samples;
+
+    void candidate(int level, unsigned long long index, const struct sumPoint& p);
+    void merge(int level, const struct sumBucket* child);
+    void close(int level);
+    void pick(int level, unsigned long long index, const struct sumBucket* next);
+    unsigned long long find(int level, unsigned time);
+
+  public:
+    /** @brief Constructor
+     *
+     * @param unsigned Samples or buckets merged into each bucket of the level above (2 or more)
+     * @param int Number of levels (1 to IS_SUMMARY_LEVELS)
+     * @param unsigned Buckets kept per level
+     *
+     */
+    CInsimSummary(unsigned factor = 4, int levelCount = 8, unsigned capacity = 1024);
+
+    void clear();                       // Forgets every sample
+    void add(unsigned time, float value);
+
+    unsigned long long getSamples() { return samples; }
+    int levelCount() { return levels.size(); }
+    unsigned long long bucketSamples(int level);    // Samples summarised by each bucket of a level
+
+    unsigned long long firstBucket(int level);      // Oldest bucket still kept
+    unsigned long long bucketCount(int level);      // Buckets complete, including those dropped from the ring
+    const struct sumBucket* getBucket(int level, unsigned long long index);    // nullptr if dropped or not complete
+
+    /** @brief Finest level to draw a time range with a number of points
+     *
+     * @param unsigned Start of the range (ms)
+     * @param unsigned End of the range (ms)
+     * @param int Maximum number of buckets
+     * @return int Level that hasn't dropped the start of the range and has no more than the given number of buckets in it, -1 if none
+     *
+     */
+    int chooseLevel(unsigned from, unsigned to, int buckets);
+
+    /** @brief Minimum and maximum of each bucket in a time range
+     *
+     * @param int Level
+     * @param unsigned Start of the range (ms)
+     * @param unsigned End of the range (ms)
+     * @param sumPoint* Output, in time order. Room for 2 points per bucket
+     * @param int Maximum number of points
+     * @return int Points written
+     *
+     */
+    int minMax(int level, unsigned from, unsigned to, struct sumPoint* out, int max);
+
+    /** @brief Points picked by LTTB in a time range
+     *
+     * @param int Level
+     * @param unsigned Start of the range (ms)
+     * @param unsigned End of the range (ms)
+     * @param sumPoint* Output, in time order. The last bucket, not picked yet, gives its last sample
+     * @param int Maximum number of points
+     * @return int Points written
+     *
+     */
+    int lttb(int level, unsigned from, unsigned to, struct sumPoint* out, int max);
+};
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimTiming
+ * ============
+ *
+ * Live timing engine. See CInsimTiming.h
+ */
+
+#include <CInsimTiming.h>
+
+CInsimTiming::CInsimTiming()
+{
+    race = true;
+    clear();
+}
+
+void CInsimTiming::clear()
+{
+    memset(rows, 0, sizeof(rows));
+    count = 0;
+    reset_times();
+    changed.set();
+}
+
+void CInsimTiming::reset_times()
+{
+    memset(progress, 0, sizeof(progress));
+    memset(pointTag, 0, sizeof(pointTag));
+    memset(carTag, 0, sizeof(carTag));
+
+    for (int i = 0; i < count; i++)
+    {
+        struct timingRow* row = &rows[order[i]];
+        row->lapsDone = 0;
+        row->split = 0;
+        row->finished = false;
+        row->result = 0;
+        row->eTime = 0;
+        row->lastLap = 0;
+        row->bestLap = 0;
+        row->gap = -1;
+        row->interval = -1;
+        row->lapsBehind = 0;
+    }
+}
+
+const struct timingRow* CInsimTiming::getRow(int position)
+{
+    if (position < 1 || position > count)
+        return nullptr;
+
+    return &rows[order[position - 1]];
+}
+
+const struct timingRow* CInsimTiming::getPlayer(byte PLID)
+{
+    return rows[PLID].position ? &rows[PLID] : nullptr;
+}
+
+int CInsimTiming::takeChanges(byte* positions)
+{
+    int n = 0;
+
+    for (int i = 0; i < 255; i++)
+    {
+        if (changed[i])
+            positions[n++] = i + 1;
+    }
+
+    changed.reset();
+    return n;
+}
+
+bool CInsimTiming::ahead(byte a, byte b)
+{
+    const struct timingRow* ra = &rows[a];
+    const struct timingRow* rb = &rows[b];
+
+    if (ra->result || rb->result)
+    {
+        if (ra->result && rb->result)
+            return ra->result < rb->result;
+        return ra->result != 0;
+    }
+
+    if (race)
+    {
+        if (progress[a] != progress[b])
+            return progress[a] > progress[b];
+        return progress[a] != 0 && ra->eTime < rb->eTime;
+    }
+
+    if (ra->bestLap && rb->bestLap)
+        return ra->bestLap < rb->bestLap;
+    return ra->bestLap != 0 && rb->bestLap == 0;
+}
+
+void CInsimTiming::add(byte PLID)
+{
+    struct timingRow* row = &rows[PLID];
+
+    memset(row, 0, sizeof(struct timingRow));
+    row->PLID = PLID;
+    row->gap = -1;
+    row->interval = -1;
+    row->position = count + 1;
+    order[count++] = PLID;
+    changed.set(count - 1);
+
+    progress[PLID] = 0;
+    memset(carTag[PLID], 0, sizeof(carTag[PLID]));
+
+    move(PLID);
+}
+
+void CInsimTiming::remove(byte PLID)
+{
+    if (!rows[PLID].position)
+        return;
+
+    // Everyone behind moves up one place
+    for (int i = rows[PLID].position - 1; i < count - 1; i++)
+    {
+        order[i] = order[i + 1];
+        rows[order[i]].position = i + 1;
+        changed.set(i);
+    }
+
+    count--;
+    changed.set(count);
+    rows[PLID].position = 0;
+}
+
+/**
+* Move a car up or down until the order is right again. Costs one step per place gained or lost
+*/
+void CInsimTiming::move(byte PLID)
+{
+    int from = rows[PLID].position - 1;
+    int i = from;
+
+    while (i > 0 && ahead(PLID, order[i - 1]))
+    {
+        order[i] = order[i - 1];
+        rows[order[i]].position = i + 1;
+        changed.set(i);
+        i--;
+    }
+
+    while (i < count - 1 && ahead(order[i + 1], PLID))
+    {
+        order[i] = order[i + 1];
+        rows[order[i]].position = i + 1;
+        changed.set(i);
+        i++;
+    }
+
+    order[i] = PLID;
+    rows[PLID].position = i + 1;
+    changed.set(i);
+
+    if (race)
+        return;
+
+    // Best laps: the gaps are relative to the fastest, the intervals to the car ahead
+    if (i == 0)
+    {
+        for (int j = 0; j < count; j++)
+            update_gaps(order[j]);
+    }
+    else
+    {
+        int last = (from > i ? from : i) + 1;
+        for (int j = (from < i ? from : i); j <= last && j < count; j++)
+            update_gaps(order[j]);
+    }
+}
+
+void CInsimTiming::update_gaps(byte PLID)
+{
+    struct timingRow* row = &rows[PLID];
+    int idx = row->position - 1;
+    byte leader = order[0];
+
+    changed.set(idx);
+
+    if (!race)
+    {
+        if (!row->bestLap || !rows[leader].bestLap)
+        {
+            row->gap = -1;
+            row->interval = -1;
+            return;
+        }
+
+        row->gap = row->bestLap - rows[leader].bestLap;
+        row->interval = idx == 0 ? 0 : (rows[order[idx - 1]].bestLap ? (int)(row->bestLap - rows[order[idx - 1]].bestLap) : -1);
+        return;
+    }
+
+    unsigned point = progress[PLID];
+
+    if (PLID == leader)
+    {
+        row->gap = 0;
+        row->interval = 0;
+        row->lapsBehind = 0;
+        return;
+    }
+
+    row->lapsBehind = progress[leader] > point ? (progress[leader] - point) / 4 : 0;
+
+    unsigned slot = point % IS_TIMING_POINTS;
+    row->gap = (row->lapsBehind == 0 && pointTag[slot] == point + 1) ? (int)(row->eTime - pointTime[slot]) : -1;
+
+    // When the car ahead crossed this same point
+    byte prev = order[idx - 1];
+    unsigned h = point % IS_TIMING_HISTORY;
+    row->interval = carTag[prev][h] == point + 1 ? (int)(row->eTime - carTime[prev][h]) : -1;
+}
+
+void CInsimTiming::cross(byte PLID, unsigned point, unsigned eTime)
+{
+    unsigned slot = point % IS_TIMING_POINTS;
+    unsigned h = point % IS_TIMING_HISTORY;
+
+    rows[PLID].eTime = eTime;
+    progress[PLID] = point;
+
+    // The first car to get there
+    if (pointTag[slot] != point + 1)
+    {
+        pointTag[slot] = point + 1;
+        pointTime[slot] = eTime;
+    }
+
+    carTag[PLID][h] = point + 1;
+    carTime[PLID][h] = eTime;
+
+    move(PLID);
+    update_gaps(PLID);
+}
+
+void CInsimTiming::update(void* packet)
+{
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_RST:
+        {
+            struct IS_RST* rst = (struct IS_RST*)packet;
+            race = rst->RaceLaps != 0;
+
+            // A reply to TINY_RST describes the session already going on
+            if (rst->ReqI != 0)
+                break;
+
+            reset_times();
+            changed.set();
+            break;
+        }
+
+        case ISP_REO:
+        {
+            struct IS_REO* reo = (struct IS_REO*)packet;
+            int nump = reo->NumP > 40 ? 40 : reo->NumP;
+            int n = 0;
+
+            // The new grid first, then whoever it didn't mention
+            for (int i = 0; i < nump; i++)
+            {
+                byte p = reo->PLID[i];
+                if (rows[p].position)
+                {
+                    rows[p].position = 0;
+                    order[n++] = p;
+                }
+            }
+
+            for (int p = 1; p < 256; p++)
+            {
+                if (rows[p].position)
+                    order[n++] = p;
+            }
+
+            for (int i = 0; i < n; i++)
+                rows[order[i]].position = i + 1;
+
+            changed.set();
+            break;
+        }
+
+        case ISP_NPL:
+        {
+            struct IS_NPL* npl = (struct IS_NPL*)packet;
+            if (npl->NumP != 0 && !rows[npl->PLID].position)
+                add(npl->PLID);
+            break;
+        }
+
+        case ISP_PLL:
+            remove(((struct IS_PLL*)packet)->PLID);
+            break;
+
+        case ISP_LAP:
+        {
+            struct IS_LAP* lap = (struct IS_LAP*)packet;
+            struct timingRow* row = &rows[lap->PLID];
+
+            if (!row->position)
+                break;
+
+            row->lapsDone = lap->LapsDone;
+            row->split = 0;
+            row->lastLap = lap->LTime;
+            row->numStops = lap->NumStops;
+            row->penalty = lap->Penalty;
+
+            bool best = lap->LTime && (!row->bestLap || lap->LTime < row->bestLap);
+            if (best)
+                row->bestLap = lap->LTime;
+
+            if (race)
+                cross(lap->PLID, lap->LapsDone * 4, lap->ETime);
+            else if (best)
+                move(lap->PLID);
+            else
+                changed.set(row->position - 1);
+            break;
+        }
+
+        case ISP_SPX:
+        {
+            struct IS_SPX* spx = (struct IS_SPX*)packet;
+            struct timingRow* row = &rows[spx->PLID];
+
+            if (!row->position || spx->Split < 1 || spx->Split > 3)
+                break;
+
+            row->split = spx->Split;
+            row->numStops = spx->NumStops;
+            row->penalty = spx->Penalty;
+
+            if (race)
+                cross(spx->PLID, row->lapsDone * 4 + spx->Split, spx->ETime);
+            else
+                changed.set(row->position - 1);
+            break;
+        }
+
+        case ISP_FIN:
+        {
+            struct IS_FIN* fin = (struct IS_FIN*)packet;
+            struct timingRow* row = &rows[fin->PLID];
+
+            if (!row->position)
+                break;
+
+            row->finished = true;
+            row->numStops = fin->NumStops;
+            changed.set(row->position - 1);
+            break;
+        }
+
+        case ISP_RES:
+        {
+            struct IS_RES* res = (struct IS_RES*)packet;
+            struct timingRow* row = &rows[res->PLID];
+
+            if (!row->position)
+                break;
+
+            row->result = res->ResultNum == 255 ? 0 : res->ResultNum + 1;
+            row->numStops = res->NumStops;
+            if (res->BTime)
+                row->bestLap = res->BTime;
+
+            move(res->PLID);
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                clear();
+            break;
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimTiming
+ * ============
+ *
+ * Live timing engine. Fed with the packets of a connection (IS_RST, IS_REO,
+ * IS_NPL, IS_PLL, IS_LAP, IS_SPX, IS_FIN, IS_RES), it keeps the standings in
+ * order as the events arrive instead of sorting them again:
+ *
+ * - Race: laps and splits done first, then who got there first. Gaps and
+ *   intervals are measured at the last timing point each car crossed.
+ * - Qualifying and practice: best lap first.
+ * - Confirmed results (IS_RES) take precedence over both.
+ *
+ * An event only moves the car it is about, by as many places as it gains or
+ * loses, and marks the rows that changed. takeChanges() hands them over so a
+ * timing screen only redraws those.
+ */
+
+#ifndef _CINSIMTIMING_H
+#define _CINSIMTIMING_H
+
+#include "CInsim.h"
+
+#include <bitset>
+
+#define IS_TIMING_HISTORY 16            // Timing points remembered per car for the intervals (4 laps with 3 splits)
+#define IS_TIMING_POINTS 1024           // Timing points remembered for the leader's times
+
+// A line of the standings
+struct timingRow
+{
+    byte    PLID;
+    byte    position;                   // 1 = leader
+    word    lapsDone;                   // laps completed
+    byte    split;                      // last split crossed in the current lap, 0 if none
+    bool    finished;                   // IS_FIN received
+    byte    result;                     // confirmed position (IS_RES ResultNum + 1), 0 if none
+    byte    numStops;                   // number of pit stops
+    byte    penalty;                    // current penalty value
+    unsigned eTime;                     // race time at the last timing point (ms)
+    unsigned lastLap;                   // (ms), 0 if none
+    unsigned bestLap;                   // (ms), 0 if none
+    int     gap;                        // race: behind the leader at the same point / qualifying: best lap behind the fastest (ms, -1 if unknown)
+    int     interval;                   // same, to the car ahead (ms, -1 if unknown)
+    word    lapsBehind;                 // race: laps behind the leader (gap is -1 then)
+};
+
+/**
+* CInsimTiming class to keep the standings of a session in order
+*/
+class CInsimTiming
+{
+  private:
+    struct timingRow rows[256];         // Indexed by PLID
+    byte order[256];                    // PLIDs by position, order[0] is the leader
+    int count;
+    bool race;                          // Ordered by progress (race) or by best lap (qualifying, practice)
+
+    unsigned progress[256];             // Timing points crossed: 4 per lap, plus the splits of the current lap
+    unsigned pointTime[IS_TIMING_POINTS];       // ETime of the first car at each timing point
+    unsigned pointTag[IS_TIMING_POINTS];        // Timing point stored in each slot (+1, 0 = empty)
+    unsigned carTime[256][IS_TIMING_HISTORY];   // ETime of each car at its last timing points
+    unsigned carTag[256][IS_TIMING_HISTORY];
+
+    std::bitset<256> changed;           // Positions (0 based) to redraw
+
+    bool ahead(byte a, byte b);         // true if a is placed before b
+    void add(byte PLID);
+    void remove(byte PLID);
+    void move(byte PLID);               // Restores the order around a car whose key changed
+    void cross(byte PLID, unsigned point, unsigned eTime);     // A car reached a timing point
+    void update_gaps(byte PLID);
+    void reset_times();
+
+  public:
+    CInsimTiming();
+
+    void clear();                       // Forgets the players
+    void update(void* packet);          // Applies a packet received from LFS. Other types are ignored
+
+    int playerCount() { return count; }
+    const struct timingRow* getRow(int position);       // 1 = leader, nullptr if out of range
+    const struct timingRow* getPlayer(byte PLID);       // nullptr if not in the session
+
+    /** @brief Rows changed since the last call
+     *
+     * @param byte* Positions (1 = leader) to redraw, in increasing order. Room for 255 entries
+     * @return int Number of positions written
+     *
+     */
+    int takeChanges(byte* positions);
+};
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimUco
+ * =========
+ *
+ * InSim checkpoint and circle timing. See CInsimUco.h
+ */
+
+#include <CInsimUco.h>
+
+CInsimUco::CInsimUco()
+{
+    clear();
+}
+
+void CInsimUco::clear()
+{
+    objectCount = 0;
+    memset(keys, 0, sizeof(keys));
+    routeLength = 0;
+    loop = false;
+    memset(routeIndex, -1, sizeof(routeIndex));
+    reset_cars();
+}
+
+void CInsimUco::reset_cars()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        memset(&cars[i], 0, sizeof(struct ucoCar));
+        cars[i].last = -1;
+        cars[i].circle = -1;
+        cars[i].next = -1;
+    }
+
+    memset(sessionBest, 0, sizeof(sessionBest));
+    sessionBestRun = 0;
+}
+
+void CInsimUco::setCrossingCallback(crossingFunc func)
+{
+    on_crossing = func;
+}
+
+unsigned long long CInsimUco::key(byte index, short x, short y, byte number)
+{
+    return (unsigned long long)index << 40 | (unsigned long long)(word)x << 24 | (unsigned long long)(word)y << 8 | number;
+}
+
+int CInsimUco::find(unsigned long long k, bool add)
+{
+    unsigned slot = (unsigned)((k * 0x9E3779B97F4A7C15ull) >> 32) & (IS_UCO_TABLE - 1);
+
+    // Linear probing. The table is never more than a quarter full
+    while (keys[slot])
+    {
+        if (keys[slot] == k + 1)
+            return ids[slot];
+        slot = (slot + 1) & (IS_UCO_TABLE - 1);
+    }
+
+    if (!add || objectCount == IS_UCO_MAX_OBJECTS)
+        return -1;
+
+    keys[slot] = k + 1;
+    ids[slot] = objectCount;
+    return objectCount++;
+}
+
+int CInsimUco::addObject(byte index, short x, short y, byte number)
+{
+    int id = find(key(index, x, y, number), true);
+
+    if (id >= 0)
+    {
+        objects[id].Index = index;
+        objects[id].X = x;
+        objects[id].Y = y;
+        objects[id].number = number;
+    }
+
+    return id;
+}
+
+// Checkpoint number in Flags bits 0-1, circle number in Heading
+static inline byte object_number(const ObjectInfo* info)
+{
+    return info->Index == UCO_INDEX_CP ? (info->Flags & 3) : info->Heading;
+}
+
+int CInsimUco::getObjectId(const ObjectInfo* info)
+{
+    return find(key(info->Index, info->X, info->Y, object_number(info)), false);
+}
+
+int CInsimUco::setRoute(const int* ids, int length, bool lap)
+{
+    if (length != 0 && (length < 2 || length > IS_UCO_MAX_ROUTE))
+        return -1;
+
+    for (int i = 0; i < length; i++)
+    {
+        if (ids[i] < 0 || ids[i] >= objectCount)
+            return -1;
+
+        // Each object once, so its position tells the segment
+        for (int j = 0; j < i; j++)
+        {
+            if (ids[j] == ids[i])
+                return -1;
+        }
+    }
+
+    memset(routeIndex, -1, sizeof(routeIndex));
+    for (int i = 0; i < length; i++)
+    {
+        route[i] = ids[i];
+        routeIndex[ids[i]] = i;
+    }
+
+    routeLength = length;
+    loop = lap;
+
+    // Runs in progress were on the old route
+    for (int i = 0; i < 256; i++)
+    {
+        cars[i].next = -1;
+        memset(cars[i].best, 0, sizeof(cars[i].best));
+        cars[i].bestRun = 0;
+    }
+
+    memset(sessionBest, 0, sizeof(sessionBest));
+    sessionBestRun = 0;
+    return 0;
+}
+
+void CInsimUco::route_step(struct ucoCar* car, struct ucoCrossing* c)
+{
+    if (c->action == UCO_CP_REV)
+    {
+        car->valid = false;
+        c->valid = false;
+        return;
+    }
+
+    int r = routeIndex[c->object];
+
+    if (r < 0)
+        return;
+
+    // The first object starts a run, unless it closes a lap
+    if (r == 0 && !(loop && car->next == 0))
+    {
+        car->next = 1;
+        car->valid = true;
+        car->runStart = c->time;
+        car->routeTime = c->time;
+        c->valid = true;
+        return;
+    }
+
+    if (car->next < 0)
+        return;
+
+    // Skipped or out of order: still timed, no longer valid
+    if (r != car->next)
+        car->valid = false;
+
+    c->routeSegment = r;
+    unsigned t = c->time - car->routeTime;
+
+    if (car->valid)
+    {
+        if (!car->best[r] || t < car->best[r])
+            car->best[r] = t;
+        if (!sessionBest[r] || t < sessionBest[r])
+            sessionBest[r] = t;
+    }
+
+    car->routeTime = c->time;
+    c->valid = car->valid;
+
+    bool finished = loop ? r == 0 : r == routeLength - 1;
+
+    if (finished)
+    {
+        if (car->valid)
+        {
+            c->run = c->time - car->runStart;
+
+            if (!car->bestRun || c->run < car->bestRun)
+                car->bestRun = c->run;
+            if (!sessionBestRun || c->run < sessionBestRun)
+                sessionBestRun = c->run;
+        }
+
+        // A lap goes straight into the next one
+        car->next = loop ? 1 : -1;
+        car->valid = true;
+        car->runStart = c->time;
+    }
+    else
+        car->next = (r + 1) % routeLength;
+}
+
+void CInsimUco::update(void* packet)
+{
+    switch (*((byte*)packet + 1))
+    {
+        case ISP_UCO:
+        {
+            struct IS_UCO* uco = (struct IS_UCO*)packet;
+
+            if (uco->Info.Index != UCO_INDEX_CP && uco->Info.Index != UCO_INDEX_CIRCLE)
+                break;
+
+            int id = addObject(uco->Info.Index, uco->Info.X, uco->Info.Y, object_number(&uco->Info));
+            if (id < 0)
+                break;
+
+            struct ucoCar* car = &cars[uco->PLID];
+            struct ucoCrossing* c = &car->lastCrossing;
+
+            c->PLID = uco->PLID;
+            c->object = id;
+            c->action = uco->UCOAction;
+            c->time = uco->Time;
+            c->from = -1;
+            c->segment = 0;
+            c->routeSegment = -1;
+            c->run = 0;
+
+            if (uco->UCOAction == UCO_CIRCLE_LEAVE)
+            {
+                // Time spent in the circle
+                if (car->circle == id)
+                {
+                    c->from = id;
+                    c->segment = uco->Time - car->circleTime;
+                }
+                car->circle = -1;
+                c->valid = car->next >= 0 && car->valid;
+            }
+            else
+            {
+                if (car->last >= 0)
+                {
+                    c->from = car->last;
+                    c->segment = uco->Time - car->lastTime;
+                }
+
+                if (uco->UCOAction == UCO_CIRCLE_ENTER)
+                {
+                    car->circle = id;
+                    car->circleTime = uco->Time;
+                }
+
+                c->valid = car->next >= 0 && car->valid;
+                if (routeLength)
+                    route_step(car, c);
+
+                car->last = id;
+                car->lastTime = uco->Time;
+            }
+
+            if (on_crossing)
+                on_crossing(c);
+            break;
+        }
+
+        case ISP_RST:
+            // A reply to TINY_RST describes the session already going on
+            if (((struct IS_RST*)packet)->ReqI == 0)
+                reset_cars();
+            break;
+
+        case ISP_PLL:
+        {
+            // The PLID is free for the next player
+            struct ucoCar* car = &cars[((struct IS_PLL*)packet)->PLID];
+
+            memset(car, 0, sizeof(struct ucoCar));
+            car->last = -1;
+            car->circle = -1;
+            car->next = -1;
+            break;
+        }
+
+        case ISP_TINY:
+            if (((struct IS_TINY*)packet)->SubT == TINY_CLR || ((struct IS_TINY*)packet)->SubT == TINY_MPE)
+                reset_cars();
+            break;
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CInsimUco
+ * =========
+ *
+ * Timing with InSim checkpoints (layout object Index 252) and circles
+ * (Index 253) from IS_UCO. Every object is given a dense ID the first time
+ * it is seen (or with addObject()), found by its position and index through
+ * a small hash table, so an event costs a lookup and a few comparisons:
+ *
+ * - Each crossing is timed against the previous one of the same car, in
+ *   hundredths of a second as given by IS_UCO, and a circle left against
+ *   its entry.
+ * - With a route set (setRoute()), the cars must cross its objects in
+ *   order. Crossing its first object starts a run, crossing an object out
+ *   of order or a checkpoint in reverse invalidates it until the next start.
+ *   Segment k ends at the k-th object of the route; the best valid time of
+ *   each segment is kept per player and for the session.
+ *
+ * An IS_RST that isn't a reply to TINY_RST resets the cars and the bests,
+ * the object IDs stay.
+ */
+
+#ifndef _CINSIMUCO_H
+#define _CINSIMUCO_H
+
+#include "CInsim.h"
+
+#define IS_UCO_MAX_OBJECTS 256          // Objects with an ID
+#define IS_UCO_MAX_ROUTE 64             // Objects in a route
+#define IS_UCO_TABLE 1024               // Hash table slots, power of 2 and more than IS_UCO_MAX_OBJECTS
+
+#define UCO_INDEX_CP 252                // ObjectInfo::Index of InSim checkpoints
+#define UCO_INDEX_CIRCLE 253            // ObjectInfo::Index of InSim circles
+
+// A checkpoint or a circle
+struct ucoObject
+{
+    byte        Index;                  // UCO_INDEX_CP or UCO_INDEX_CIRCLE
+    short       X;                      // As in ObjectInfo (1/16 m)
+    short       Y;
+    byte        number;                 // Checkpoint 0 (finish) to 3 (Flags bits 0-1), or circle index (Heading)
+};
+
+// An IS_UCO event, timed
+struct ucoCrossing
+{
+    byte        PLID;
+    int         object;                 // Object ID
+    byte        action;                 // UCO_ action
+    unsigned    time;                   // Hundredths of a second since the start
+    int         from;                   // Previous object crossed by the car (the circle entered for UCO_CIRCLE_LEAVE), -1 if none
+    unsigned    segment;                // Hundredths since crossing from, 0 if none
+    int         routeSegment;           // Route segment ended by this crossing, -1 if none
+    bool        valid;                  // The run this crossing belongs to is valid so far (false if there is no run)
+    unsigned    run;                    // Run time when this crossing completed a valid run, 0 otherwise
+};
+
+/**
+* CInsimUco class to time InSim checkpoints and circles
+*/
+class CInsimUco
+{
+  public:
+    // Called for every IS_UCO of a known player
+    typedef std::function<void (const struct ucoCrossing* crossing)> crossingFunc;
+
+  private:
+    struct ucoObject objects[IS_UCO_MAX_OBJECTS];
+    int objectCount;
+    unsigned long long keys[IS_UCO_TABLE];      // Object key + 1, 0 = empty
+    short ids[IS_UCO_TABLE];
+
+    int route[IS_UCO_MAX_ROUTE];
+    int routeLength;
+    bool loop;                          // The last object of the route leads to the first one
+    short routeIndex[IS_UCO_MAX_OBJECTS];       // Position of each object in the route, -1 if not in it
+
+    struct ucoCar
+    {
+        int         last;               // Last object crossed, -1 if none
+        unsigned    lastTime;
+        int         circle;             // Circle the car is in, -1 if none
+        unsigned    circleTime;
+        int         next;               // Position in the route of the next object expected, -1 if no run
+        unsigned    routeTime;          // When the car crossed the previous object of the route
+        bool        valid;
+        unsigned    runStart;
+        unsigned    best[IS_UCO_MAX_ROUTE];     // Best valid time of each segment, 0 if none
+        unsigned    bestRun;
+        struct ucoCrossing lastCrossing;
+    };
+
+    struct ucoCar cars[256];            // Indexed by PLID
+    unsigned sessionBest[IS_UCO_MAX_ROUTE];
+    unsigned sessionBestRun;
+    crossingFunc on_crossing;
+
+    static unsigned long long key(byte index, short x, short y, byte number);
+    int find(unsigned long long k, bool add);
+    void reset_cars();
+    void route_step(struct ucoCar* car, struct ucoCrossing* c);
+
+  public:
+    CInsimUco();
+
+    void clear();                       // Forgets the objects, the route and the times
+    void update(void* packet);          // Applies an IS_UCO, IS_RST, IS_PLL or TINY_CLR/MPE. Other types are ignored
+    void setCrossingCallback(crossingFunc func);
+
+    int addObject(byte index, short x, short y, byte number);  // ID of an object, registered if new. -1 if the table is full
+    int getObjectId(const ObjectInfo* info);                    // -1 if unknown
+    const struct ucoObject* getObject(int id) { return id >= 0 && id < objectCount ? &objects[id] : nullptr; }
+    int getObjectCount() { return objectCount; }
+
+    /** @brief Set the route of a run
+     *
+     * @param int* Object IDs in driving order, the first one starts a run
+     * @param int Number of objects (2 to IS_UCO_MAX_ROUTE), 0 to remove the route
+     * @param bool Lap: after the last object the run ends at the first one
+     * @return int 0, or -1 if the route is not valid
+     *
+     */
+    int setRoute(const int* route, int length, bool loop);
+
+    const struct ucoCrossing* getLast(byte PLID) { return cars[PLID].lastCrossing.PLID ? &cars[PLID].lastCrossing : nullptr; }  // nullptr if none since the start
+    unsigned getBest(byte PLID, int segment) { return segment >= 0 && segment < routeLength ? cars[PLID].best[segment] : 0; }
+    unsigned getBestRun(byte PLID) { return cars[PLID].bestRun; }
+    unsigned getSessionBest(int segment) { return segment >= 0 && segment < routeLength ? sessionBest[segment] : 0; }
+    unsigned getSessionBestRun() { return sessionBestRun; }
+};
+
+#endif
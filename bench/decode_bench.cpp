@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013, Cristóbal Marco
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * decode_bench
+ * ============
+ *
+ * Time of decodeCars() on a 40-car MCI frame with each code path (scalar,
+ * SSE2, AVX2), and check that they all give the same floats. Paths the CPU
+ * doesn't support are skipped. From the top directory:
+ *
+ *   g++ -std=c++11 -O2 -I. bench/decode_bench.cpp CInsimDecode.cpp -o decode_bench && ./decode_bench
+ */
+
+#include <CInsimDecode.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#define BENCH_CARS 40
+#define BENCH_FRAMES 2000000
+
+static const char* pathName[] = { "scalar", "SSE2", "AVX2" };
+
+// A grid spread over a track, with every field in its usual range
+static void fill(CompCar* cars, int count)
+{
+    unsigned r = 12345;
+
+    for (int i = 0; i < count; i++)
+    {
+        memset(&cars[i], 0, sizeof(CompCar));
+
+        r = r * 1103515245 + 12345;
+        cars[i].X = (int)(r % 2000000000) - 1000000000;
+        r = r * 1103515245 + 12345;
+        cars[i].Y = (int)(r % 2000000000) - 1000000000;
+        r = r * 1103515245 + 12345;
+        cars[i].Z = (int)(r % 20000000);
+        cars[i].Speed = (word)(r >> 16) % 40000;
+        cars[i].Direction = (word)(r >> 8);
+        cars[i].Heading = (word)(r >> 4);
+        cars[i].AngVel = (short)(r >> 12);
+        cars[i].PLID = i + 1;
+    }
+}
+
+int main()
+{
+    CompCar cars[BENCH_CARS];
+    struct carFloats reference, out;
+    int best = decodeLevel();
+
+    fill(cars, BENCH_CARS);
+
+    // Only the first BENCH_CARS entries are written
+    memset(&reference, 0, sizeof(reference));
+    memset(&out, 0, sizeof(out));
+
+    decodeForce(DECODE_SCALAR);
+    decodeCars(cars, BENCH_CARS, &reference);
+
+    for (int level = DECODE_SCALAR; level <= DECODE_AVX2; level++)
+    {
+        if (level > best)
+        {
+            printf("%-7s not supported by this CPU\n", pathName[level]);
+            continue;
+        }
+
+        decodeForce(level);
+
+        // Warm up the caches and the branch predictor
+        for (int i = 0; i < 10000; i++)
+            decodeCars(cars, BENCH_CARS, &out);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        volatile float sink = 0;
+
+        for (int i = 0; i < BENCH_FRAMES; i++)
+        {
+            decodeCars(cars, BENCH_CARS, &out);
+            sink = sink + out.X[i % BENCH_CARS];
+        }
+
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_FRAMES;
+        bool same = memcmp(&out, &reference, sizeof(out)) == 0;
+
+        printf("%-7s %7.1f ns per frame %5.2f ns per car  %s\n", pathName[level], ns, ns / BENCH_CARS, same ? "same as scalar" : "DIFFERS FROM SCALAR");
+    }
+
+    decodeForce(best);
+    return 0;
+}